@@ -0,0 +1,59 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "bench-stats.h"
+
+double
+bench_now(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+double
+bench_cpu_time(pid_t pid)
+{
+   char path[64], buf[1024], *p;
+   unsigned long long utime, stime;
+   FILE *f;
+   size_t n;
+
+   snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+   f = fopen(path, "r");
+   if (!f)
+     return -1;
+   n = fread(buf, 1, sizeof(buf) - 1, f);
+   fclose(f);
+   buf[n] = '\0';
+
+   /* The command name may hold spaces, fields are counted after it */
+   p = strrchr(buf, ')');
+   if (!p || sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u "
+                    "%llu %llu", &utime, &stime) != 2)
+     return -1;
+   return (double)(utime + stime) / sysconf(_SC_CLK_TCK);
+}
+
+static int
+_cmp(const void *a, const void *b)
+{
+   const double *x = a, *y = b;
+
+   return (*x > *y) - (*x < *y);
+}
+
+double
+bench_percentile(Eina_Inarray *samples, unsigned p)
+{
+   unsigned n = eina_inarray_count(samples);
+   double *v;
+
+   if (!n)
+     return -1;
+   eina_inarray_sort(samples, _cmp);
+   v = eina_inarray_nth(samples, (n - 1) * p / 100);
+   return *v * 1000;
+}
@@ -0,0 +1,19 @@
+#ifndef BENCH_STATS_H
+#define BENCH_STATS_H
+
+#include <sys/types.h>
+#include <Eina.h>
+
+/* Helpers shared by the benchmark tools */
+
+/* Monotonic, in seconds */
+double bench_now(void);
+
+/* User and system time of a process in seconds, -1 if unknown */
+double bench_cpu_time(pid_t pid);
+
+/* Sorts the samples, doubles in seconds, and returns the p-th percentile
+   in milliseconds, -1 without samples */
+double bench_percentile(Eina_Inarray *samples, unsigned p);
+
+#endif
@@ -0,0 +1,213 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "event-log.h"
+
+/* How long the logging thread sleeps when no ring had anything */
+#define IDLE_NSEC (5 * 1000 * 1000)
+
+static struct {
+   Eina_Lock lock;
+   Eina_List *rings;
+   Eina_Thread thread;
+   Event_Log_Print_Cb print;
+   atomic_bool stop;
+   atomic_bool tracing;
+   /* Under the lock */
+   FILE *trace;
+   unsigned trace_seats;
+} event_log;
+
+static void
+_trace_stop(void)
+{
+   if (fclose(event_log.trace))
+     perror("Input trace");
+   event_log.trace = NULL;
+   atomic_store_explicit(&event_log.tracing, EINA_FALSE,
+                         memory_order_relaxed);
+}
+
+static void
+_ring_trace(Event_Ring *ring, unsigned type, uint32_t time, int32_t a,
+            int32_t b)
+{
+   if (!event_log.trace)
+     return;
+   if (ring->trace_seat < 0)
+     ring->trace_seat = event_log.trace_seats++;
+   ring->trace_time = time;
+   if (!event_trace_write(event_log.trace, ring->trace_seat, type, time,
+                          a, b))
+     {
+        perror("Input trace");
+        _trace_stop();
+     }
+}
+
+/* Returns how many records were printed */
+static unsigned
+_ring_drain(Event_Ring *ring)
+{
+   const struct Event_Record *ev;
+   unsigned tail, head, dropped, n;
+
+   tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+   head = atomic_load_explicit(&ring->head, memory_order_acquire);
+   for (n = 0; tail != head; tail++, n++)
+     {
+        ev = &ring->records[tail & (EVENT_RING_SIZE - 1)];
+        event_log.print(ring->name, ev);
+        _ring_trace(ring, ev->type, ev->time, ev->a, ev->b);
+     }
+   atomic_store_explicit(&ring->tail, tail, memory_order_release);
+
+   dropped = atomic_exchange_explicit(&ring->dropped, 0, memory_order_relaxed);
+   if (dropped)
+     {
+        printf("Seat '%s' dropped %u input events\n", ring->name, dropped);
+        /* Replays know the seat saw more than they get */
+        _ring_trace(ring, EVENT_TRACE_DROPPED, ring->trace_time, dropped, 0);
+     }
+   return n;
+}
+
+static unsigned
+_rings_drain(void)
+{
+   Event_Ring *ring;
+   Eina_List *l, *l_next;
+   Eina_Bool closed;
+   unsigned n = 0;
+
+   eina_lock_take(&event_log.lock);
+   EINA_LIST_FOREACH_SAFE(event_log.rings, l, l_next, ring)
+     {
+        /* Read before draining, so nothing pushed before closing is lost */
+        closed = atomic_load_explicit(&ring->closed, memory_order_acquire);
+        n += _ring_drain(ring);
+        if (!closed)
+          continue;
+        if (event_log.trace && ring->trace_seat >= 0)
+          _ring_trace(ring, EVENT_TRACE_SEAT_GONE, ring->trace_time, 0, 0);
+        event_log.rings = eina_list_remove_list(event_log.rings, l);
+        free(ring->name);
+        free(ring);
+     }
+
+   if (n)
+     {
+        fflush(stdout);
+        if (event_log.trace && fflush(event_log.trace))
+          {
+             perror("Input trace");
+             _trace_stop();
+          }
+     }
+   eina_lock_release(&event_log.lock);
+   return n;
+}
+
+static void *
+_log_thread(void *data, Eina_Thread t)
+{
+   struct timespec idle = { 0, IDLE_NSEC };
+   Eina_Bool stop;
+
+   for (;;)
+     {
+        stop = atomic_load_explicit(&event_log.stop, memory_order_acquire);
+        if (!_rings_drain() && !stop)
+          nanosleep(&idle, NULL);
+        if (stop)
+          break;
+     }
+   return NULL;
+}
+
+Eina_Bool
+event_log_init(Event_Log_Print_Cb print)
+{
+   event_log.print = print;
+   atomic_init(&event_log.stop, EINA_FALSE);
+   EINA_SAFETY_ON_FALSE_RETURN_VAL(eina_lock_new(&event_log.lock), EINA_FALSE);
+   if (!eina_thread_create(&event_log.thread, EINA_THREAD_BACKGROUND, -1,
+                           _log_thread, NULL))
+     {
+        eina_lock_free(&event_log.lock);
+        return EINA_FALSE;
+     }
+   return EINA_TRUE;
+}
+
+void
+event_log_shutdown(void)
+{
+   Event_Ring *ring;
+
+   atomic_store_explicit(&event_log.stop, EINA_TRUE, memory_order_release);
+   eina_thread_join(event_log.thread);
+
+   /* Rings never closed by their seat */
+   EINA_LIST_FREE(event_log.rings, ring)
+     {
+        free(ring->name);
+        free(ring);
+     }
+   if (event_log.trace)
+     _trace_stop();
+   eina_lock_free(&event_log.lock);
+}
+
+Eina_Bool
+event_log_trace_start(const char *path, enum Event_Trace_Source source)
+{
+   FILE *trace;
+
+   trace = event_trace_create(path, source);
+   if (!trace)
+     return EINA_FALSE;
+
+   eina_lock_take(&event_log.lock);
+   if (event_log.trace)
+     _trace_stop();
+   event_log.trace = trace;
+   atomic_store_explicit(&event_log.tracing, EINA_TRUE, memory_order_relaxed);
+   eina_lock_release(&event_log.lock);
+   return EINA_TRUE;
+}
+
+Eina_Bool
+event_log_tracing(void)
+{
+   return atomic_load_explicit(&event_log.tracing, memory_order_relaxed);
+}
+
+Event_Ring *
+event_log_ring_new(const char *name)
+{
+   Event_Ring *ring;
+
+   ring = aligned_alloc(EVENT_CACHE_LINE, sizeof(Event_Ring));
+   EINA_SAFETY_ON_NULL_RETURN_VAL(ring, NULL);
+   memset(ring, 0, sizeof(Event_Ring));
+   ring->trace_seat = -1;
+   ring->name = strdup(name);
+   EINA_SAFETY_ON_NULL_GOTO(ring->name, err_name);
+
+   eina_lock_take(&event_log.lock);
+   event_log.rings = eina_list_append(event_log.rings, ring);
+   eina_lock_release(&event_log.lock);
+   return ring;
+
+ err_name:
+   free(ring);
+   return NULL;
+}
+
+void
+event_log_ring_close(Event_Ring *ring)
+{
+   atomic_store_explicit(&ring->closed, EINA_TRUE, memory_order_release);
+}
@@ -0,0 +1,89 @@
+#ifndef EVENT_LOG_H
+#define EVENT_LOG_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <Eina.h>
+#include "event-trace.h"
+
+/* Input events are not printed where they are dispatched: each seat pushes
+   fixed size records to its own ring and a logging thread prints them, so
+   dispatch never waits on stdout. Rings have a single producer, the thread
+   dispatching the seat input, and a single consumer, the logging thread. */
+
+/* Records, a power of 2 */
+#define EVENT_RING_SIZE (1024)
+#define EVENT_CACHE_LINE (64)
+
+struct Event_Record {
+   uint32_t type;
+   /* Milliseconds on a clock of the server, only differences matter */
+   uint32_t time;
+   /* x and y for motions, the button or key and its state otherwise */
+   int32_t a, b;
+};
+
+typedef struct _Event_Ring {
+   /* Producer and consumer positions never share a cache line */
+   _Alignas(EVENT_CACHE_LINE) atomic_uint head;
+   _Alignas(EVENT_CACHE_LINE) atomic_uint tail;
+   /* Only touched by the producer */
+   _Alignas(EVENT_CACHE_LINE) unsigned tail_cache;
+   atomic_uint dropped;
+   atomic_bool closed;
+   /* Only touched by the logging thread, -1 until it is in the trace */
+   int trace_seat;
+   uint32_t trace_time;
+   char *name;
+   struct Event_Record records[EVENT_RING_SIZE];
+} Event_Ring;
+
+/* Called on the logging thread for every record */
+typedef void (*Event_Log_Print_Cb)(const char *seat,
+                                   const struct Event_Record *ev);
+
+Eina_Bool event_log_init(Event_Log_Print_Cb print);
+/* Prints what is left and joins the logging thread */
+void event_log_shutdown(void);
+
+/* Also writes every record of every seat to a binary trace at path, see
+   event-trace.h. Rings made before are traced too. */
+Eina_Bool event_log_trace_start(const char *path,
+                                enum Event_Trace_Source source);
+/* Whether input is traced, for producers to not coalesce it */
+Eina_Bool event_log_tracing(void);
+
+Event_Ring *event_log_ring_new(const char *name);
+/* The ring is freed by the logging thread once drained, the producer must
+   not push to it anymore */
+void event_log_ring_close(Event_Ring *ring);
+
+/* Never blocks, events are dropped and counted while the ring is full */
+static inline void
+event_log_push(Event_Ring *ring, enum Event_Type type, uint32_t time,
+               int32_t a, int32_t b)
+{
+   unsigned head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+   struct Event_Record *ev;
+
+   if (head - ring->tail_cache == EVENT_RING_SIZE)
+     {
+        ring->tail_cache = atomic_load_explicit(&ring->tail,
+                                                memory_order_acquire);
+        if (head - ring->tail_cache == EVENT_RING_SIZE)
+          {
+             atomic_fetch_add_explicit(&ring->dropped, 1,
+                                       memory_order_relaxed);
+             return;
+          }
+     }
+
+   ev = &ring->records[head & (EVENT_RING_SIZE - 1)];
+   ev->type = type;
+   ev->time = time;
+   ev->a = a;
+   ev->b = b;
+   atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+#endif
@@ -0,0 +1,96 @@
+#include <stdlib.h>
+#include <string.h>
+#include "event-trace.h"
+
+/* Records are small, writes only hit the disk a buffer at a time */
+#define TRACE_BUFFER (256 * 1024)
+
+FILE *
+event_trace_create(const char *path, enum Event_Trace_Source source)
+{
+   struct Event_Trace_Header header = { .source = source };
+   FILE *f;
+
+   f = fopen(path, "wbe");
+   if (!f)
+     {
+        perror(path);
+        return NULL;
+     }
+   setvbuf(f, NULL, _IOFBF, TRACE_BUFFER);
+   memcpy(header.magic, EVENT_TRACE_MAGIC, EVENT_TRACE_MAGIC_LEN);
+   if (fwrite(&header, sizeof(header), 1, f) != 1)
+     {
+        perror(path);
+        fclose(f);
+        return NULL;
+     }
+   return f;
+}
+
+Eina_Bool
+event_trace_write(FILE *f, unsigned seat, unsigned type, uint32_t time,
+                  int32_t a, int32_t b)
+{
+   struct Event_Trace_Record rec = {
+      .seat = seat, .type = type, .time = time, .a = a, .b = b
+   };
+
+   return fwrite(&rec, sizeof(rec), 1, f) == 1;
+}
+
+Eina_Inarray *
+event_trace_load(const char *path, enum Event_Trace_Source *source,
+                 unsigned *nseats)
+{
+   struct Event_Trace_Header header;
+   struct Event_Trace_Record rec;
+   Eina_Inarray *records;
+   unsigned seats = 0;
+   FILE *f;
+
+   f = fopen(path, "rbe");
+   if (!f)
+     {
+        perror(path);
+        return NULL;
+     }
+   if (fread(&header, sizeof(header), 1, f) != 1 ||
+       memcmp(header.magic, EVENT_TRACE_MAGIC, EVENT_TRACE_MAGIC_LEN) ||
+       header.source > EVENT_TRACE_WAYLAND)
+     {
+        fprintf(stderr, "%s is not an input trace\n", path);
+        goto err_header;
+     }
+
+   records = eina_inarray_new(sizeof(rec), 4096);
+   EINA_SAFETY_ON_NULL_GOTO(records, err_header);
+   /* A trace cut short by a crash ends at its last whole record */
+   while (fread(&rec, sizeof(rec), 1, f) == 1)
+     {
+        /* Each seat is numbered right after the last one seen */
+        if (rec.seat > seats)
+          {
+             fprintf(stderr, "%s has seat %u before seat %u\n", path,
+                     rec.seat, seats);
+             goto err_push;
+          }
+        if (rec.seat == seats)
+          seats++;
+        EINA_SAFETY_ON_TRUE_GOTO(eina_inarray_push(records, &rec) < 0,
+                                 err_push);
+     }
+   fclose(f);
+
+   if (source)
+     *source = header.source;
+   if (nseats)
+     *nseats = seats;
+   return records;
+
+ err_push:
+   eina_inarray_free(records);
+ err_header:
+   fclose(f);
+   return NULL;
+}
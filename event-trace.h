@@ -0,0 +1,65 @@
+#ifndef EVENT_TRACE_H
+#define EVENT_TRACE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <Eina.h>
+
+/* Input traces: a header then fixed size records, in host byte order,
+   appended as the seats get input. Seats are numbered in the order their
+   first event was written. */
+
+#define EVENT_TRACE_MAGIC "MSTRACE2"
+#define EVENT_TRACE_MAGIC_LEN (8)
+
+/* What the keys and buttons mean */
+enum Event_Trace_Source {
+   /* Keysyms, buttons 1 to 8 */
+   EVENT_TRACE_VNC,
+   /* Linux key codes, buttons 1 to 3 for left, middle and right and linux
+      codes for the others */
+   EVENT_TRACE_WAYLAND
+};
+
+/* What the input records are, shared with event-log.h */
+enum Event_Type {
+   EVENT_POINTER_MOTION,
+   EVENT_POINTER_BUTTON,
+   EVENT_KEY
+};
+
+/* Only in traces */
+enum Event_Trace_Type {
+   /* Closed after its last event */
+   EVENT_TRACE_SEAT_GONE = 16,
+   /* a events were dropped while the seat ring was full */
+   EVENT_TRACE_DROPPED
+};
+
+struct Event_Trace_Header {
+   char magic[EVENT_TRACE_MAGIC_LEN];
+   uint32_t source;
+   uint32_t reserved;
+};
+
+struct Event_Trace_Record {
+   /* As many as the seat ids of either program */
+   uint32_t seat;
+   uint32_t type;
+   /* Milliseconds, only the difference between records means anything */
+   uint32_t time;
+   int32_t a, b;
+};
+
+/* Writing, from a single thread */
+FILE *event_trace_create(const char *path, enum Event_Trace_Source source);
+Eina_Bool event_trace_write(FILE *f, unsigned seat, unsigned type,
+                            uint32_t time, int32_t a, int32_t b);
+
+/* Reads a whole trace, NULL if it is not one. Tells how many seats it has
+   when nseats is given. */
+Eina_Inarray *event_trace_load(const char *path,
+                               enum Event_Trace_Source *source,
+                               unsigned *nseats);
+
+#endif
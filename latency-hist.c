@@ -0,0 +1,115 @@
+#include <string.h>
+#include "latency-hist.h"
+
+static unsigned
+_bucket(uint32_t usec)
+{
+   unsigned shift;
+
+   if (usec < LATENCY_HIST_SUB)
+     return usec;
+   shift = 32 - __builtin_clz(usec) - LATENCY_HIST_SUB_BITS;
+   return LATENCY_HIST_SUB + (shift - 1) * (LATENCY_HIST_SUB / 2) +
+          (usec >> shift) - LATENCY_HIST_SUB / 2;
+}
+
+/* The middle of the bucket, in microseconds */
+static double
+_bucket_value(unsigned i)
+{
+   unsigned shift, sub;
+
+   if (i < LATENCY_HIST_SUB)
+     return i;
+   i -= LATENCY_HIST_SUB;
+   shift = i / (LATENCY_HIST_SUB / 2) + 1;
+   sub = i % (LATENCY_HIST_SUB / 2) + LATENCY_HIST_SUB / 2;
+   return ((double)sub + 0.5) * (1u << shift);
+}
+
+void
+latency_hist_reset(Latency_Hist *h)
+{
+   memset(h, 0, sizeof(Latency_Hist));
+}
+
+void
+latency_hist_record(Latency_Hist *h, double seconds)
+{
+   double usec = seconds * 1e6;
+   uint32_t v;
+
+   if (usec < 0)
+     usec = 0;
+   v = usec >= UINT32_MAX ? UINT32_MAX : (uint32_t)usec;
+   h->buckets[_bucket(v)]++;
+   h->count++;
+   h->sum += v;
+   if (v > h->max)
+     h->max = v;
+}
+
+void
+latency_hist_merge(Latency_Hist *dst, const Latency_Hist *src)
+{
+   unsigned i;
+
+   for (i = 0; i < LATENCY_HIST_BUCKETS; i++)
+     dst->buckets[i] += src->buckets[i];
+   dst->count += src->count;
+   dst->sum += src->sum;
+   if (src->max > dst->max)
+     dst->max = src->max;
+}
+
+double
+latency_hist_percentile(const Latency_Hist *h, double p)
+{
+   uint64_t rank, seen = 0;
+   double v;
+   unsigned i;
+
+   if (!h->count)
+     return -1;
+   rank = (uint64_t)(p / 100 * h->count + 0.5);
+   if (rank < 1)
+     rank = 1;
+   if (rank > h->count)
+     rank = h->count;
+
+   for (i = 0; i < LATENCY_HIST_BUCKETS; i++)
+     {
+        seen += h->buckets[i];
+        if (seen >= rank)
+          break;
+     }
+   /* The middle of the last bucket can be past what was ever recorded */
+   v = _bucket_value(i);
+   if (v > h->max)
+     v = h->max;
+   return v / 1000;
+}
+
+double
+latency_hist_mean(const Latency_Hist *h)
+{
+   if (!h->count)
+     return -1;
+   return (double)h->sum / h->count / 1000;
+}
+
+void
+latency_hist_print(const Latency_Hist *h, FILE *f, const char *label)
+{
+   if (!h->count)
+     {
+        fprintf(f, "%s: no samples\n", label);
+        return;
+     }
+   fprintf(f, "%s: %llu samples, mean %.2f p50 %.2f p90 %.2f p99 %.2f "
+           "p99.9 %.2f max %.2f ms\n", label, (unsigned long long)h->count,
+           latency_hist_mean(h),
+           latency_hist_percentile(h, 50), latency_hist_percentile(h, 90),
+           latency_hist_percentile(h, 99), latency_hist_percentile(h, 99.9),
+           h->max / 1000.);
+}
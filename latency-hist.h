@@ -0,0 +1,36 @@
+#ifndef LATENCY_HIST_H
+#define LATENCY_HIST_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* Log-linear latency histogram in the manner of HdrHistogram: values below
+   LATENCY_HIST_SUB microseconds are counted exactly, every power of 2 above
+   is split in LATENCY_HIST_SUB / 2 linear buckets, so any value is known
+   within 1/64 of itself. Recording is a couple of shifts and an increment,
+   cheap enough for every frame of every seat. Not thread safe. */
+
+#define LATENCY_HIST_SUB_BITS (7)
+#define LATENCY_HIST_SUB (1 << LATENCY_HIST_SUB_BITS)
+/* Up to 2^32 microseconds, a bit more than an hour */
+#define LATENCY_HIST_BUCKETS \
+   (LATENCY_HIST_SUB + (32 - LATENCY_HIST_SUB_BITS) * (LATENCY_HIST_SUB / 2))
+
+typedef struct _Latency_Hist {
+   uint64_t count;
+   uint64_t sum;
+   uint32_t max;
+   uint32_t buckets[LATENCY_HIST_BUCKETS];
+} Latency_Hist;
+
+void latency_hist_reset(Latency_Hist *h);
+/* Seconds, as ecore_time_get() and bench_now() give them */
+void latency_hist_record(Latency_Hist *h, double seconds);
+void latency_hist_merge(Latency_Hist *dst, const Latency_Hist *src);
+/* In milliseconds, p between 0 and 100, -1 without samples */
+double latency_hist_percentile(const Latency_Hist *h, double p);
+double latency_hist_mean(const Latency_Hist *h);
+/* One line: count, mean, p50, p90, p99, p99.9 and max */
+void latency_hist_print(const Latency_Hist *h, FILE *f, const char *label);
+
+#endif
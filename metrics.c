@@ -0,0 +1,307 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "metrics.h"
+
+/* Readers being written to, past that the oldest one is cut */
+#define CONNS_MAX 8
+/* Accepted per call, the rest stay in the backlog for the next one */
+#define ACCEPTS_MAX 4
+
+/* A reader and what it still has to take of its dump */
+struct Conn {
+   EINA_INLIST;
+   int fd;
+   char *dump;
+   size_t len;
+   size_t sent;
+};
+
+static const struct {
+   const char *name;
+   const char *type;
+} metric_info[METRIC_LAST] = {
+   [METRIC_EVENTS] = { "events_total", "counter" },
+   [METRIC_BYTES_SENT] = { "bytes_sent_total", "counter" },
+   [METRIC_FRAMES] = { "frames_rendered_total", "counter" },
+   [METRIC_FRAMES_DROPPED] = { "frames_dropped_total", "counter" },
+   [METRIC_ENCODE_NSEC] = { "encode_seconds_total", "counter" },
+   [METRIC_INPUT_THROTTLED] = { "input_throttled_total", "counter" },
+   [METRIC_QUEUED_BYTES] = { "queued_bytes", "gauge" },
+};
+
+static struct {
+   char prefix[64];
+   char path[PATH_MAX];
+   unsigned used;
+   int fd;
+   /* The listener and the readers, level triggered */
+   int epoll_fd;
+   Eina_Inlist *conns;
+   unsigned nconns;
+   Eina_Inlist *seats;
+   unsigned nseats;
+   uint64_t connected;
+   uint64_t disconnected;
+} metrics = { .fd = -1, .epoll_fd = -1 };
+
+static int
+_listen(const char *path)
+{
+   struct sockaddr_un addr;
+   int fd;
+
+   memset(&addr, 0, sizeof(addr));
+   addr.sun_family = AF_UNIX;
+   if (strlen(path) >= sizeof(addr.sun_path))
+     return -1;
+   strcpy(addr.sun_path, path);
+
+   fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+   if (fd == -1)
+     return -1;
+   /* Left behind by a process that did not exit cleanly */
+   unlink(path);
+   if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+       listen(fd, 8) == -1)
+     {
+        close(fd);
+        return -1;
+     }
+   return fd;
+}
+
+void
+metrics_init(const char *program, unsigned used)
+{
+   struct epoll_event ev;
+   const char *dir;
+   unsigned i;
+
+   /* Metric names only take [a-zA-Z0-9_] */
+   snprintf(metrics.prefix, sizeof(metrics.prefix), "%s", program);
+   for (i = 0; metrics.prefix[i]; i++)
+     if (metrics.prefix[i] == '-')
+       metrics.prefix[i] = '_';
+   metrics.used = used;
+
+   dir = getenv("XDG_RUNTIME_DIR");
+   if (!dir)
+     dir = "/tmp";
+   snprintf(metrics.path, sizeof(metrics.path), "%s/%s-%d.metrics", dir,
+            program, (int)getpid());
+   metrics.fd = _listen(metrics.path);
+   if (metrics.fd == -1)
+     goto err;
+   metrics.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+   if (metrics.epoll_fd == -1)
+     goto err_epoll;
+   /* The listener is the only one without a Conn */
+   ev.events = EPOLLIN;
+   ev.data.ptr = NULL;
+   if (epoll_ctl(metrics.epoll_fd, EPOLL_CTL_ADD, metrics.fd, &ev) == -1)
+     goto err_ctl;
+   printf("Metrics on %s\n", metrics.path);
+   return;
+
+ err_ctl:
+   close(metrics.epoll_fd);
+   metrics.epoll_fd = -1;
+ err_epoll:
+   close(metrics.fd);
+   unlink(metrics.path);
+   metrics.fd = -1;
+ err:
+   fprintf(stderr, "No metrics socket at %s: %s\n", metrics.path,
+           strerror(errno));
+}
+
+static void
+_conn_del(struct Conn *c)
+{
+   metrics.conns = eina_inlist_remove(metrics.conns, EINA_INLIST_GET(c));
+   metrics.nconns--;
+   /* Also takes it out of the epoll set */
+   close(c->fd);
+   free(c->dump);
+   free(c);
+}
+
+void
+metrics_shutdown(void)
+{
+   if (metrics.fd == -1)
+     return;
+   while (metrics.conns)
+     _conn_del(EINA_INLIST_CONTAINER_GET(metrics.conns, struct Conn));
+   close(metrics.epoll_fd);
+   close(metrics.fd);
+   unlink(metrics.path);
+   metrics.epoll_fd = -1;
+   metrics.fd = -1;
+}
+
+int
+metrics_fd(void)
+{
+   return metrics.epoll_fd;
+}
+
+/* Label values escape backslashes, quotes and new lines */
+static void
+_label_print(FILE *f, const char *s)
+{
+   for (; *s; s++)
+     {
+        if (*s == '\\' || *s == '"')
+          fputc('\\', f);
+        if (*s == '\n')
+          {
+             fputs("\\n", f);
+             continue;
+          }
+        fputc(*s, f);
+     }
+}
+
+void
+metrics_dump(FILE *f)
+{
+   Metrics *m;
+   unsigned k;
+
+   fprintf(f, "# TYPE %s_seats gauge\n%s_seats %u\n", metrics.prefix,
+           metrics.prefix, metrics.nseats);
+   fprintf(f, "# TYPE %s_seats_connected_total counter\n"
+           "%s_seats_connected_total %llu\n", metrics.prefix,
+           metrics.prefix, (unsigned long long)metrics.connected);
+   fprintf(f, "# TYPE %s_seats_disconnected_total counter\n"
+           "%s_seats_disconnected_total %llu\n", metrics.prefix,
+           metrics.prefix, (unsigned long long)metrics.disconnected);
+
+   for (k = 0; k < METRIC_LAST; k++)
+     {
+        if (!(metrics.used & METRIC_MASK(k)))
+          continue;
+        fprintf(f, "# TYPE %s_%s %s\n", metrics.prefix, metric_info[k].name,
+                metric_info[k].type);
+        EINA_INLIST_FOREACH(metrics.seats, m)
+          {
+             fprintf(f, "%s_%s{seat=\"", metrics.prefix, metric_info[k].name);
+             _label_print(f, m->name);
+             if (k == METRIC_ENCODE_NSEC)
+               fprintf(f, "\"} %.6f\n", m->values[k] / 1e9);
+             else
+               fprintf(f, "\"} %llu\n", (unsigned long long)m->values[k]);
+          }
+     }
+}
+
+/* Sends what the socket takes, the rest waits for it to be writable */
+static void
+_conn_write(struct Conn *c)
+{
+   ssize_t n;
+
+   while (c->sent < c->len)
+     {
+        n = send(c->fd, c->dump + c->sent, c->len - c->sent,
+                 MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0 && errno == EINTR)
+          continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+          return;
+        if (n <= 0)
+          break;
+        c->sent += n;
+     }
+   _conn_del(c);
+}
+
+static void
+_conn_add(int fd)
+{
+   struct epoll_event ev;
+   struct Conn *c;
+   FILE *f;
+
+   if (metrics.nconns == CONNS_MAX)
+     _conn_del(EINA_INLIST_CONTAINER_GET(metrics.conns, struct Conn));
+
+   c = calloc(1, sizeof(struct Conn));
+   if (!c)
+     goto err;
+   f = open_memstream(&c->dump, &c->len);
+   if (!f)
+     goto err_dump;
+   metrics_dump(f);
+   if (fclose(f) != 0)
+     goto err_dump;
+   c->fd = fd;
+   ev.events = EPOLLOUT;
+   ev.data.ptr = c;
+   if (epoll_ctl(metrics.epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1)
+     goto err_dump;
+   metrics.conns = eina_inlist_append(metrics.conns, EINA_INLIST_GET(c));
+   metrics.nconns++;
+   return;
+
+ err_dump:
+   free(c->dump);
+   free(c);
+ err:
+   close(fd);
+}
+
+void
+metrics_serve(void)
+{
+   struct epoll_event ev[CONNS_MAX + 1];
+   Eina_Bool pending = EINA_FALSE;
+   int i, n, fd;
+
+   if (metrics.epoll_fd == -1)
+     return;
+   n = epoll_wait(metrics.epoll_fd, ev, CONNS_MAX + 1, 0);
+   for (i = 0; i < n; i++)
+     {
+        if (ev[i].data.ptr)
+          _conn_write(ev[i].data.ptr);
+        else
+          pending = EINA_TRUE;
+     }
+   /* Last, making room may cut a reader the events above point to */
+   for (i = 0; pending && i < ACCEPTS_MAX; i++)
+     {
+        fd = accept4(metrics.fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd == -1 && errno == EINTR)
+          continue;
+        if (fd == -1)
+          break;
+        _conn_add(fd);
+     }
+}
+
+void
+metrics_seat_add(Metrics *m, const char *name)
+{
+   snprintf(m->name, sizeof(m->name), "%s", name);
+   metrics.seats = eina_inlist_append(metrics.seats, EINA_INLIST_GET(m));
+   metrics.nseats++;
+   metrics.connected++;
+}
+
+void
+metrics_seat_del(Metrics *m)
+{
+   metrics.seats = eina_inlist_remove(metrics.seats, EINA_INLIST_GET(m));
+   metrics.nseats--;
+   metrics.disconnected++;
+}
@@ -0,0 +1,64 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <Eina.h>
+
+/* Per seat counters, served on a local Unix socket and dumped on SIGUSR1
+   in the Prometheus text format. Each seat embeds its counters and only
+   the thread dispatching the seat writes them, so counting is a plain add
+   next to the rest of the seat state. Work done on other threads is
+   counted there and handed over when it is done. Reading walks the seats
+   from the dispatching thread too. */
+
+enum Metric {
+   METRIC_EVENTS,
+   METRIC_BYTES_SENT,
+   METRIC_FRAMES,
+   METRIC_FRAMES_DROPPED,
+   METRIC_ENCODE_NSEC,
+   /* Input messages that waited for the seat rate limit */
+   METRIC_INPUT_THROTTLED,
+   /* A gauge, every other one only goes up */
+   METRIC_QUEUED_BYTES,
+   METRIC_LAST
+};
+
+#define METRIC_MASK(m) (1u << (m))
+
+typedef struct _Metrics {
+   EINA_INLIST;
+   char name[32];
+   uint64_t values[METRIC_LAST];
+} Metrics;
+
+/* Listens on $XDG_RUNTIME_DIR/<program>-<pid>.metrics, only the metrics
+   in the used mask are reported. Without a socket the dump still works. */
+void metrics_init(const char *program, unsigned used);
+void metrics_shutdown(void);
+/* Readable while connections wait to be accepted or written to, it is
+   level triggered. -1 if there is no socket. */
+int metrics_fd(void);
+/* Accepts a few connections and writes their dumps as far as the sockets
+   take them, it never waits for a reader */
+void metrics_serve(void);
+void metrics_dump(FILE *f);
+
+/* Counts a connection, the seat is reported until deleted */
+void metrics_seat_add(Metrics *m, const char *name);
+void metrics_seat_del(Metrics *m);
+
+static inline void
+metrics_add(Metrics *m, enum Metric k, uint64_t n)
+{
+   m->values[k] += n;
+}
+
+static inline void
+metrics_set(Metrics *m, enum Metric k, uint64_t n)
+{
+   m->values[k] = n;
+}
+
+#endif
@@ -0,0 +1,1161 @@
+/* Headless compositor to benchmark multi-seat-wayland without Weston or
+   input devices: it advertises seats, injects pointer and keyboard events
+   on them at given rates, can hot plug and unplug seats in storms and
+   reports how fast clients keep up, measured by shell surface pings.
+
+   With -t, it replays an input trace recorded by multi-seat-wayland -r, or
+   multi-seat-vnc -r, instead: one seat per traced seat, each input sent as
+   far from the first surface as it was recorded, divided by the -x speed,
+   and it quits once the whole trace is sent. */
+
+#define _GNU_SOURCE
+
+#include <Eina.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <wayland-server.h>
+
+#include "bench-stats.h"
+#include "event-trace.h"
+
+#define COMPOSITOR_VERSION (4)
+#define SHELL_VERSION (1)
+#define SEAT_VERSION (5)
+
+#define WIDTH (800)
+#define HEIGHT (600)
+
+/* It uses button and key numbers from linux/input.h */
+#define BTN_LEFT 0x110
+#define BTN_RIGHT 0x111
+#define BTN_MIDDLE 0x112
+#define KEY_A 30
+
+/* Timers, in milliseconds */
+#define TICK_MS (1)
+#define FRAME_MS (16)
+#define PING_MS (100)
+#define REPORT_MS (1000)
+/* Events of a kind a seat sends per tick at most, what a tick could not
+   send is skipped rather than piled on a client that is behind */
+#define TICK_MAX_EVENTS (64)
+/* Removed seats stay bindable this long, as clients may not have seen the
+   removal yet */
+#define SEAT_REMOVE_DELAY (1.0)
+
+struct Seat {
+   struct wl_global *global;
+   char name[32];
+   struct wl_list resources;
+   struct wl_list pointers;
+   struct wl_list keyboards;
+   struct wl_list link;
+   double start;
+   /* When the global was removed, 0 while advertised */
+   double removed;
+   /* Events due since start, sent or skipped */
+   unsigned long motions, buttons, keys;
+   bool pressed, key_down;
+   /* Replayed records of the seat instead of the rates above */
+   Eina_Inarray *trace;
+   unsigned step;
+};
+
+struct Surface {
+   struct wl_resource *resource;
+   struct wl_resource *buffer;
+   struct wl_listener buffer_destroy;
+   /* Frame callbacks not committed yet */
+   struct wl_list frames;
+   struct wl_list link;
+};
+
+struct Shell_Surface {
+   struct wl_resource *resource;
+   uint32_t ping_serial;
+   /* When the ping in flight was sent, 0 without one */
+   double ping_time;
+   struct wl_list link;
+};
+
+static struct {
+   struct wl_display *display;
+   struct wl_list seats;
+   struct wl_list surfaces;
+   struct wl_list shell_surfaces;
+   /* Committed frame callbacks */
+   struct wl_list frames;
+   struct wl_event_source *tick, *frame, *report, *hotplug;
+   unsigned next_seat;
+   int null_fd;
+   double start;
+   /* Per seat, in events per second */
+   double motion_rate, button_rate, key_rate;
+   unsigned hotplug_ms, hotplug_count;
+   double duration;
+   /* Since the last report */
+   unsigned long events;
+   unsigned hotplugs;
+   Eina_Inarray *pongs;
+   /* Replaying a trace, 0 speed sends as fast as it can */
+   bool replay;
+   enum Event_Trace_Source source;
+   uint32_t trace_base;
+   double speed;
+   /* When the first surface came, 0 before */
+   double replay_start;
+   /* Seats with records left */
+   unsigned replaying;
+} mock;
+
+static uint32_t
+_msec(void)
+{
+   return (uint32_t)(bench_now() * 1000);
+}
+
+static void
+_resource_destroy(struct wl_client *client, struct wl_resource *resource)
+{
+   wl_resource_destroy(resource);
+}
+
+static void
+_resource_unlink(struct wl_resource *resource)
+{
+   wl_list_remove(wl_resource_get_link(resource));
+}
+
+/* Input goes to the first surface of a client, nothing has focus before */
+static struct Surface *
+_client_surface(struct wl_client *client)
+{
+   struct Surface *surface;
+
+   wl_list_for_each(surface, &mock.surfaces, link)
+     if (wl_resource_get_client(surface->resource) == client)
+       return surface;
+   return NULL;
+}
+
+static void
+_pointer_focus(struct wl_resource *pointer, struct Surface *surface)
+{
+   wl_pointer_send_enter(pointer, wl_display_next_serial(mock.display),
+                         surface->resource, wl_fixed_from_int(0),
+                         wl_fixed_from_int(0));
+   if (wl_resource_get_version(pointer) >= WL_POINTER_FRAME_SINCE_VERSION)
+     wl_pointer_send_frame(pointer);
+}
+
+static void
+_keyboard_focus(struct wl_resource *keyboard, struct Surface *surface)
+{
+   struct wl_array keys;
+
+   wl_array_init(&keys);
+   wl_keyboard_send_enter(keyboard, wl_display_next_serial(mock.display),
+                          surface->resource, &keys);
+   wl_array_release(&keys);
+}
+
+static void
+_pointer_set_cursor(struct wl_client *client, struct wl_resource *resource,
+                    uint32_t serial, struct wl_resource *surface,
+                    int32_t hotspot_x, int32_t hotspot_y)
+{
+}
+
+static const struct wl_pointer_interface _pointer_impl = {
+   .set_cursor = _pointer_set_cursor,
+   .release = _resource_destroy
+};
+
+static const struct wl_keyboard_interface _keyboard_impl = {
+   .release = _resource_destroy
+};
+
+static const struct wl_touch_interface _touch_impl = {
+   .release = _resource_destroy
+};
+
+static void
+_seat_get_pointer(struct wl_client *client, struct wl_resource *resource,
+                  uint32_t id)
+{
+   struct Seat *seat = wl_resource_get_user_data(resource);
+   struct wl_resource *pointer;
+   struct Surface *surface;
+
+   pointer = wl_resource_create(client, &wl_pointer_interface,
+                                wl_resource_get_version(resource), id);
+   if (!pointer)
+     {
+        wl_client_post_no_memory(client);
+        return;
+     }
+   wl_resource_set_implementation(pointer, &_pointer_impl, seat,
+                                  _resource_unlink);
+   /* From a seat already gone, it never gets anything */
+   if (!seat)
+     {
+        wl_list_init(wl_resource_get_link(pointer));
+        return;
+     }
+   wl_list_insert(&seat->pointers, wl_resource_get_link(pointer));
+
+   surface = _client_surface(client);
+   if (surface)
+     _pointer_focus(pointer, surface);
+}
+
+static void
+_seat_get_keyboard(struct wl_client *client, struct wl_resource *resource,
+                   uint32_t id)
+{
+   struct Seat *seat = wl_resource_get_user_data(resource);
+   struct wl_resource *keyboard;
+   struct Surface *surface;
+
+   keyboard = wl_resource_create(client, &wl_keyboard_interface,
+                                 wl_resource_get_version(resource), id);
+   if (!keyboard)
+     {
+        wl_client_post_no_memory(client);
+        return;
+     }
+   wl_resource_set_implementation(keyboard, &_keyboard_impl, seat,
+                                  _resource_unlink);
+   wl_keyboard_send_keymap(keyboard, WL_KEYBOARD_KEYMAP_FORMAT_NO_KEYMAP,
+                           mock.null_fd, 0);
+   if (!seat)
+     {
+        wl_list_init(wl_resource_get_link(keyboard));
+        return;
+     }
+   wl_list_insert(&seat->keyboards, wl_resource_get_link(keyboard));
+
+   surface = _client_surface(client);
+   if (surface)
+     _keyboard_focus(keyboard, surface);
+}
+
+static void
+_seat_get_touch(struct wl_client *client, struct wl_resource *resource,
+                uint32_t id)
+{
+   struct wl_resource *touch;
+
+   /* Not in the capabilities, but a client may still ask */
+   touch = wl_resource_create(client, &wl_touch_interface,
+                              wl_resource_get_version(resource), id);
+   if (!touch)
+     {
+        wl_client_post_no_memory(client);
+        return;
+     }
+   wl_resource_set_implementation(touch, &_touch_impl, NULL, NULL);
+}
+
+static const struct wl_seat_interface _seat_impl = {
+   .get_pointer = _seat_get_pointer,
+   .get_keyboard = _seat_get_keyboard,
+   .get_touch = _seat_get_touch,
+   .release = _resource_destroy
+};
+
+static void
+_seat_bind(struct wl_client *client, void *data, uint32_t version,
+           uint32_t id)
+{
+   struct Seat *seat = data;
+   struct wl_resource *resource;
+
+   resource = wl_resource_create(client, &wl_seat_interface, version, id);
+   if (!resource)
+     {
+        wl_client_post_no_memory(client);
+        return;
+     }
+   wl_resource_set_implementation(resource, &_seat_impl, seat,
+                                  _resource_unlink);
+   wl_list_insert(&seat->resources, wl_resource_get_link(resource));
+
+   wl_seat_send_capabilities(resource, WL_SEAT_CAPABILITY_POINTER |
+                             WL_SEAT_CAPABILITY_KEYBOARD);
+   if (version >= WL_SEAT_NAME_SINCE_VERSION)
+     wl_seat_send_name(resource, seat->name);
+}
+
+static struct Seat *
+_seat_add(void)
+{
+   struct Seat *seat;
+
+   seat = calloc(1, sizeof(struct Seat));
+   EINA_SAFETY_ON_NULL_RETURN_VAL(seat, NULL);
+   snprintf(seat->name, sizeof(seat->name), "seat%u", mock.next_seat++);
+   wl_list_init(&seat->resources);
+   wl_list_init(&seat->pointers);
+   wl_list_init(&seat->keyboards);
+
+   seat->global = wl_global_create(mock.display, &wl_seat_interface,
+                                   SEAT_VERSION, seat, _seat_bind);
+   EINA_SAFETY_ON_NULL_GOTO(seat->global, err_global);
+   /* A seat plugged later does not catch up on the events due before */
+   seat->start = bench_now();
+   wl_list_insert(mock.seats.prev, &seat->link);
+   return seat;
+
+ err_global:
+   free(seat);
+   return NULL;
+}
+
+/* Clients are told first, the global is destroyed later */
+static void
+_seat_remove(struct Seat *seat)
+{
+   wl_global_remove(seat->global);
+   seat->removed = bench_now();
+}
+
+static void
+_seat_free(struct Seat *seat)
+{
+   struct wl_list *lists[] = {
+      &seat->resources, &seat->pointers, &seat->keyboards
+   };
+   struct wl_resource *resource, *tmp;
+   unsigned i;
+
+   /* Resources outliving the seat become inert */
+   for (i = 0; i < sizeof(lists) / sizeof(lists[0]); i++)
+     wl_resource_for_each_safe(resource, tmp, lists[i])
+       {
+          wl_resource_set_user_data(resource, NULL);
+          wl_list_remove(wl_resource_get_link(resource));
+          wl_list_init(wl_resource_get_link(resource));
+       }
+   wl_global_destroy(seat->global);
+   wl_list_remove(&seat->link);
+   if (seat->trace)
+     eina_inarray_free(seat->trace);
+   free(seat);
+}
+
+static void
+_seat_send_motion(struct Seat *seat, uint32_t time, int sx, int sy)
+{
+   struct wl_resource *pointer;
+   wl_fixed_t x, y;
+
+   x = wl_fixed_from_int(sx);
+   y = wl_fixed_from_int(sy);
+   wl_resource_for_each(pointer, &seat->pointers)
+     {
+        if (!_client_surface(wl_resource_get_client(pointer)))
+          continue;
+        wl_pointer_send_motion(pointer, time, x, y);
+        if (wl_resource_get_version(pointer) >= WL_POINTER_FRAME_SINCE_VERSION)
+          wl_pointer_send_frame(pointer);
+        mock.events++;
+     }
+}
+
+static void
+_seat_send_button(struct Seat *seat, uint32_t time, uint32_t button,
+                  bool pressed)
+{
+   struct wl_resource *pointer;
+   uint32_t serial = wl_display_next_serial(mock.display);
+
+   wl_resource_for_each(pointer, &seat->pointers)
+     {
+        if (!_client_surface(wl_resource_get_client(pointer)))
+          continue;
+        wl_pointer_send_button(pointer, serial, time, button,
+                               pressed ?
+                               WL_POINTER_BUTTON_STATE_PRESSED :
+                               WL_POINTER_BUTTON_STATE_RELEASED);
+        if (wl_resource_get_version(pointer) >= WL_POINTER_FRAME_SINCE_VERSION)
+          wl_pointer_send_frame(pointer);
+        mock.events++;
+     }
+}
+
+static void
+_seat_send_key(struct Seat *seat, uint32_t time, uint32_t key, bool pressed)
+{
+   struct wl_resource *keyboard;
+   uint32_t serial = wl_display_next_serial(mock.display);
+
+   wl_resource_for_each(keyboard, &seat->keyboards)
+     {
+        if (!_client_surface(wl_resource_get_client(keyboard)))
+          continue;
+        wl_keyboard_send_key(keyboard, serial, time, key,
+                             pressed ?
+                             WL_KEYBOARD_KEY_STATE_PRESSED :
+                             WL_KEYBOARD_KEY_STATE_RELEASED);
+        mock.events++;
+     }
+}
+
+static void
+_seat_motion(struct Seat *seat, uint32_t time)
+{
+   _seat_send_motion(seat, time, (seat->motions * 3) % WIDTH,
+                     (seat->motions * 2) % HEIGHT);
+}
+
+static void
+_seat_button(struct Seat *seat, uint32_t time)
+{
+   seat->pressed = !seat->pressed;
+   _seat_send_button(seat, time, BTN_LEFT, seat->pressed);
+}
+
+static void
+_seat_key(struct Seat *seat, uint32_t time)
+{
+   seat->key_down = !seat->key_down;
+   _seat_send_key(seat, time, KEY_A, seat->key_down);
+}
+
+/* Both servers trace left, middle and right as 1 to 3, other buttons are
+   linux codes from wayland and wheel steps from RFB, which are dropped */
+static uint32_t
+_trace_button(int32_t button)
+{
+   if (button == 1)
+     return BTN_LEFT;
+   if (button == 2)
+     return BTN_MIDDLE;
+   if (button == 3)
+     return BTN_RIGHT;
+   if (button >= BTN_LEFT && mock.source == EVENT_TRACE_WAYLAND)
+     return button;
+   return 0;
+}
+
+/* Sends the trace records that got due, late ones are not skipped so the
+   client gets the whole trace */
+static void
+_seat_replay(struct Seat *seat, double now, uint32_t time)
+{
+   const struct Event_Trace_Record *rec;
+   unsigned count = eina_inarray_count(seat->trace), n;
+   uint32_t button;
+
+   if (!mock.replay_start || seat->step == count)
+     return;
+   for (n = 0; seat->step < count && n < TICK_MAX_EVENTS; n++)
+     {
+        rec = eina_inarray_nth(seat->trace, seat->step);
+        if (mock.speed &&
+            now < mock.replay_start +
+            (uint32_t)(rec->time - mock.trace_base) / 1000.0 / mock.speed)
+          break;
+        seat->step++;
+        switch (rec->type)
+          {
+           case EVENT_POINTER_MOTION:
+              _seat_send_motion(seat, time, rec->a, rec->b);
+              break;
+           case EVENT_POINTER_BUTTON:
+              button = _trace_button(rec->a);
+              if (button)
+                _seat_send_button(seat, time, button, rec->b);
+              break;
+           case EVENT_KEY:
+              /* Keysyms have no key code without a keymap */
+              if (mock.source == EVENT_TRACE_WAYLAND)
+                _seat_send_key(seat, time, rec->a, rec->b);
+              break;
+           case EVENT_TRACE_SEAT_GONE:
+              _seat_remove(seat);
+              seat->step = count;
+              break;
+          }
+     }
+   if (seat->step == count)
+     mock.replaying--;
+}
+
+/* Sends the events that got due since the last tick */
+static void
+_seat_inject(struct Seat *seat, double now, uint32_t time)
+{
+   double elapsed = now - seat->start;
+   unsigned long due;
+   unsigned n;
+
+   due = mock.motion_rate * elapsed;
+   for (n = 0; seat->motions < due; seat->motions++)
+     if (n++ < TICK_MAX_EVENTS)
+       _seat_motion(seat, time);
+
+   due = mock.button_rate * elapsed;
+   for (n = 0; seat->buttons < due; seat->buttons++)
+     if (n++ < TICK_MAX_EVENTS)
+       _seat_button(seat, time);
+
+   due = mock.key_rate * elapsed;
+   for (n = 0; seat->keys < due; seat->keys++)
+     if (n++ < TICK_MAX_EVENTS)
+       _seat_key(seat, time);
+}
+
+static void
+_pings_send(double now)
+{
+   struct Shell_Surface *ss;
+
+   wl_list_for_each(ss, &mock.shell_surfaces, link)
+     {
+        if (ss->ping_time)
+          continue;
+        ss->ping_serial = wl_display_next_serial(mock.display);
+        ss->ping_time = now;
+        wl_shell_surface_send_ping(ss->resource, ss->ping_serial);
+     }
+}
+
+static int
+_tick(void *data)
+{
+   static double last_ping = 0;
+   struct Seat *seat;
+   double now = bench_now();
+   uint32_t time = now * 1000;
+
+   wl_list_for_each(seat, &mock.seats, link)
+     {
+        if (seat->trace)
+          _seat_replay(seat, now, time);
+        else if (!seat->removed)
+          _seat_inject(seat, now, time);
+     }
+
+   if (now - last_ping >= PING_MS / 1000.0)
+     {
+        _pings_send(now);
+        last_ping = now;
+     }
+
+   wl_event_source_timer_update(mock.tick, TICK_MS);
+   return 0;
+}
+
+static int
+_frame(void *data)
+{
+   struct wl_resource *callback, *tmp;
+   uint32_t time = _msec();
+
+   wl_resource_for_each_safe(callback, tmp, &mock.frames)
+     {
+        wl_callback_send_done(callback, time);
+        wl_resource_destroy(callback);
+     }
+
+   wl_event_source_timer_update(mock.frame, FRAME_MS);
+   return 0;
+}
+
+static int
+_report(void *data)
+{
+   static double last = 0;
+   struct Seat *seat, *tmp;
+   double now = bench_now(), elapsed;
+   unsigned nseats = 0;
+
+   wl_list_for_each_safe(seat, tmp, &mock.seats, link)
+     {
+        if (!seat->removed)
+          nseats++;
+        else if (now - seat->removed >= SEAT_REMOVE_DELAY)
+          _seat_free(seat);
+     }
+
+   elapsed = now - (last ? last : mock.start);
+   last = now;
+   printf("%6u %10.0f %8.2f %8.2f %8.2f %8u\n", nseats,
+          mock.events / elapsed, bench_percentile(mock.pongs, 50),
+          bench_percentile(mock.pongs, 99), bench_percentile(mock.pongs, 100),
+          mock.hotplugs);
+   fflush(stdout);
+   eina_inarray_flush(mock.pongs);
+   mock.events = 0;
+   mock.hotplugs = 0;
+
+   if ((mock.duration > 0 && now - mock.start >= mock.duration) ||
+       (mock.replay && !mock.replaying))
+     wl_display_terminate(mock.display);
+   else
+     wl_event_source_timer_update(mock.report, REPORT_MS);
+   return 0;
+}
+
+/* Unplugs the oldest seats and plugs as many new ones */
+static int
+_hotplug(void *data)
+{
+   struct Seat *seat;
+   unsigned i;
+
+   for (i = 0; i < mock.hotplug_count; i++)
+     {
+        wl_list_for_each(seat, &mock.seats, link)
+          if (!seat->removed)
+            break;
+        if (&seat->link != &mock.seats)
+          _seat_remove(seat);
+        if (_seat_add())
+          mock.hotplugs++;
+     }
+
+   wl_event_source_timer_update(mock.hotplug, mock.hotplug_ms);
+   return 0;
+}
+
+static void
+_buffer_destroyed(struct wl_listener *listener, void *data)
+{
+   struct Surface *surface = wl_container_of(listener, surface,
+                                             buffer_destroy);
+
+   surface->buffer = NULL;
+   wl_list_remove(&surface->buffer_destroy.link);
+}
+
+static void
+_surface_attach(struct wl_client *client, struct wl_resource *resource,
+                struct wl_resource *buffer, int32_t x, int32_t y)
+{
+   struct Surface *surface = wl_resource_get_user_data(resource);
+
+   if (surface->buffer)
+     wl_list_remove(&surface->buffer_destroy.link);
+   surface->buffer = buffer;
+   if (buffer)
+     wl_resource_add_destroy_listener(buffer, &surface->buffer_destroy);
+}
+
+static void
+_surface_damage(struct wl_client *client, struct wl_resource *resource,
+                int32_t x, int32_t y, int32_t width, int32_t height)
+{
+}
+
+static void
+_surface_frame(struct wl_client *client, struct wl_resource *resource,
+               uint32_t id)
+{
+   struct Surface *surface = wl_resource_get_user_data(resource);
+   struct wl_resource *callback;
+
+   callback = wl_resource_create(client, &wl_callback_interface, 1, id);
+   if (!callback)
+     {
+        wl_client_post_no_memory(client);
+        return;
+     }
+   wl_resource_set_implementation(callback, NULL, NULL, _resource_unlink);
+   wl_list_insert(surface->frames.prev, wl_resource_get_link(callback));
+}
+
+static void
+_surface_set_region(struct wl_client *client, struct wl_resource *resource,
+                    struct wl_resource *region)
+{
+}
+
+/* Nothing is shown, the buffer is done with as soon as committed */
+static void
+_surface_commit(struct wl_client *client, struct wl_resource *resource)
+{
+   struct Surface *surface = wl_resource_get_user_data(resource);
+
+   if (surface->buffer)
+     {
+        wl_buffer_send_release(surface->buffer);
+        wl_list_remove(&surface->buffer_destroy.link);
+        surface->buffer = NULL;
+     }
+   wl_list_insert_list(mock.frames.prev, &surface->frames);
+   wl_list_init(&surface->frames);
+}
+
+static void
+_surface_set_int(struct wl_client *client, struct wl_resource *resource,
+                 int32_t value)
+{
+}
+
+static const struct wl_surface_interface _surface_impl = {
+   .destroy = _resource_destroy,
+   .attach = _surface_attach,
+   .damage = _surface_damage,
+   .frame = _surface_frame,
+   .set_opaque_region = _surface_set_region,
+   .set_input_region = _surface_set_region,
+   .commit = _surface_commit,
+   .set_buffer_transform = _surface_set_int,
+   .set_buffer_scale = _surface_set_int,
+   .damage_buffer = _surface_damage
+};
+
+static void
+_surface_free(struct wl_resource *resource)
+{
+   struct Surface *surface = wl_resource_get_user_data(resource);
+   struct wl_resource *callback, *tmp;
+
+   wl_resource_for_each_safe(callback, tmp, &surface->frames)
+     wl_resource_destroy(callback);
+   if (surface->buffer)
+     wl_list_remove(&surface->buffer_destroy.link);
+   wl_list_remove(&surface->link);
+   free(surface);
+}
+
+static void
+_compositor_create_surface(struct wl_client *client,
+                           struct wl_resource *resource, uint32_t id)
+{
+   struct Surface *surface;
+   struct Seat *seat;
+   struct wl_resource *r;
+   bool focused;
+
+   surface = calloc(1, sizeof(struct Surface));
+   if (!surface)
+     {
+        wl_client_post_no_memory(client);
+        return;
+     }
+   surface->resource = wl_resource_create(client, &wl_surface_interface,
+                                          wl_resource_get_version(resource),
+                                          id);
+   if (!surface->resource)
+     {
+        free(surface);
+        wl_client_post_no_memory(client);
+        return;
+     }
+   wl_list_init(&surface->frames);
+   surface->buffer_destroy.notify = _buffer_destroyed;
+   wl_resource_set_implementation(surface->resource, &_surface_impl, surface,
+                                  _surface_free);
+
+   focused = _client_surface(client) != NULL;
+   wl_list_insert(mock.surfaces.prev, &surface->link);
+   /* Nothing has focus before, the trace would go nowhere */
+   if (mock.replay && !mock.replay_start)
+     mock.replay_start = bench_now();
+   if (focused)
+     return;
+
+   /* The first surface of a client gets the focus of every seat */
+   wl_list_for_each(seat, &mock.seats, link)
+     {
+        wl_resource_for_each(r, &seat->pointers)
+          if (wl_resource_get_client(r) == client)
+            _pointer_focus(r, surface);
+        wl_resource_for_each(r, &seat->keyboards)
+          if (wl_resource_get_client(r) == client)
+            _keyboard_focus(r, surface);
+     }
+}
+
+static void
+_region_op(struct wl_client *client, struct wl_resource *resource,
+           int32_t x, int32_t y, int32_t width, int32_t height)
+{
+}
+
+static const struct wl_region_interface _region_impl = {
+   .destroy = _resource_destroy,
+   .add = _region_op,
+   .subtract = _region_op
+};
+
+static void
+_compositor_create_region(struct wl_client *client,
+                          struct wl_resource *resource, uint32_t id)
+{
+   struct wl_resource *region;
+
+   region = wl_resource_create(client, &wl_region_interface, 1, id);
+   if (!region)
+     {
+        wl_client_post_no_memory(client);
+        return;
+     }
+   wl_resource_set_implementation(region, &_region_impl, NULL, NULL);
+}
+
+static const struct wl_compositor_interface _compositor_impl = {
+   .create_surface = _compositor_create_surface,
+   .create_region = _compositor_create_region
+};
+
+static void
+_compositor_bind(struct wl_client *client, void *data, uint32_t version,
+                 uint32_t id)
+{
+   struct wl_resource *resource;
+
+   resource = wl_resource_create(client, &wl_compositor_interface, version,
+                                 id);
+   if (!resource)
+     {
+        wl_client_post_no_memory(client);
+        return;
+     }
+   wl_resource_set_implementation(resource, &_compositor_impl, NULL, NULL);
+}
+
+static void
+_shell_surface_pong(struct wl_client *client, struct wl_resource *resource,
+                    uint32_t serial)
+{
+   struct Shell_Surface *ss = wl_resource_get_user_data(resource);
+   double latency;
+
+   if (!ss->ping_time || serial != ss->ping_serial)
+     return;
+   latency = bench_now() - ss->ping_time;
+   eina_inarray_push(mock.pongs, &latency);
+   ss->ping_time = 0;
+}
+
+static void
+_shell_surface_move(struct wl_client *client, struct wl_resource *resource,
+                    struct wl_resource *seat, uint32_t serial)
+{
+}
+
+static void
+_shell_surface_resize(struct wl_client *client, struct wl_resource *resource,
+                      struct wl_resource *seat, uint32_t serial,
+                      uint32_t edges)
+{
+}
+
+static void
+_shell_surface_set_toplevel(struct wl_client *client,
+                            struct wl_resource *resource)
+{
+}
+
+static void
+_shell_surface_set_transient(struct wl_client *client,
+                             struct wl_resource *resource,
+                             struct wl_resource *parent,
+                             int32_t x, int32_t y, uint32_t flags)
+{
+}
+
+static void
+_shell_surface_set_fullscreen(struct wl_client *client,
+                              struct wl_resource *resource, uint32_t method,
+                              uint32_t framerate, struct wl_resource *output)
+{
+}
+
+static void
+_shell_surface_set_popup(struct wl_client *client,
+                         struct wl_resource *resource,
+                         struct wl_resource *seat, uint32_t serial,
+                         struct wl_resource *parent,
+                         int32_t x, int32_t y, uint32_t flags)
+{
+}
+
+static void
+_shell_surface_set_maximized(struct wl_client *client,
+                             struct wl_resource *resource,
+                             struct wl_resource *output)
+{
+}
+
+static void
+_shell_surface_set_string(struct wl_client *client,
+                          struct wl_resource *resource, const char *s)
+{
+}
+
+static const struct wl_shell_surface_interface _shell_surface_impl = {
+   .pong = _shell_surface_pong,
+   .move = _shell_surface_move,
+   .resize = _shell_surface_resize,
+   .set_toplevel = _shell_surface_set_toplevel,
+   .set_transient = _shell_surface_set_transient,
+   .set_fullscreen = _shell_surface_set_fullscreen,
+   .set_popup = _shell_surface_set_popup,
+   .set_maximized = _shell_surface_set_maximized,
+   .set_title = _shell_surface_set_string,
+   .set_class = _shell_surface_set_string
+};
+
+static void
+_shell_surface_free(struct wl_resource *resource)
+{
+   struct Shell_Surface *ss = wl_resource_get_user_data(resource);
+
+   wl_list_remove(&ss->link);
+   free(ss);
+}
+
+static void
+_shell_get_shell_surface(struct wl_client *client,
+                         struct wl_resource *resource, uint32_t id,
+                         struct wl_resource *surface)
+{
+   struct Shell_Surface *ss;
+
+   ss = calloc(1, sizeof(struct Shell_Surface));
+   if (!ss)
+     {
+        wl_client_post_no_memory(client);
+        return;
+     }
+   ss->resource = wl_resource_create(client, &wl_shell_surface_interface, 1,
+                                     id);
+   if (!ss->resource)
+     {
+        free(ss);
+        wl_client_post_no_memory(client);
+        return;
+     }
+   wl_resource_set_implementation(ss->resource, &_shell_surface_impl, ss,
+                                  _shell_surface_free);
+   wl_list_insert(&mock.shell_surfaces, &ss->link);
+}
+
+static const struct wl_shell_interface _shell_impl = {
+   .get_shell_surface = _shell_get_shell_surface
+};
+
+static void
+_shell_bind(struct wl_client *client, void *data, uint32_t version,
+            uint32_t id)
+{
+   struct wl_resource *resource;
+
+   resource = wl_resource_create(client, &wl_shell_interface, version, id);
+   if (!resource)
+     {
+        wl_client_post_no_memory(client);
+        return;
+     }
+   wl_resource_set_implementation(resource, &_shell_impl, NULL, NULL);
+}
+
+static int
+_sig_action(int signum, void *data)
+{
+   wl_display_terminate(mock.display);
+   return 0;
+}
+
+/* One seat per traced seat, instead of -n */
+static Eina_Bool
+_trace_load(const char *path)
+{
+   const struct Event_Trace_Record *rec;
+   Eina_Inarray *records;
+   struct Seat **seats;
+   unsigned nseats, i, n;
+
+   records = event_trace_load(path, &mock.source, &nseats);
+   if (!records)
+     return EINA_FALSE;
+   n = eina_inarray_count(records);
+   if (!n)
+     {
+        fprintf(stderr, "Empty trace %s\n", path);
+        goto err_seats;
+     }
+   seats = calloc(nseats, sizeof(struct Seat *));
+   EINA_SAFETY_ON_NULL_GOTO(seats, err_seats);
+
+   for (i = 0; i < nseats; i++)
+     {
+        seats[i] = _seat_add();
+        EINA_SAFETY_ON_NULL_GOTO(seats[i], err_seat);
+        seats[i]->trace = eina_inarray_new(sizeof(*rec), 0);
+        EINA_SAFETY_ON_NULL_GOTO(seats[i]->trace, err_seat);
+     }
+
+   rec = eina_inarray_nth(records, 0);
+   mock.trace_base = rec->time;
+   for (i = 0; i < n; i++)
+     {
+        rec = eina_inarray_nth(records, i);
+        /* Seats are drained in turns, the earliest is not always first */
+        if ((int32_t)(rec->time - mock.trace_base) < 0)
+          mock.trace_base = rec->time;
+        EINA_SAFETY_ON_TRUE_GOTO(eina_inarray_push(seats[rec->seat]->trace,
+                                                   rec) < 0, err_seat);
+     }
+   free(seats);
+   eina_inarray_free(records);
+   mock.replay = true;
+   mock.replaying = nseats;
+   return EINA_TRUE;
+
+   /* The seats added are freed with the others */
+ err_seat:
+   free(seats);
+ err_seats:
+   eina_inarray_free(records);
+   return EINA_FALSE;
+}
+
+static void
+_usage(const char *name)
+{
+   fprintf(stderr, "Usage: %s [-s socket] [-n seats] [-m motion/s] "
+           "[-b buttons/s] [-k keys/s] [-p hotplug ms] [-c seats/hotplug] "
+           "[-d seconds] [-t trace [-x speed]]\n", name);
+}
+
+int
+main(int argc, char *argv[])
+{
+   int r = -1, opt;
+   unsigned i, nseats = 4;
+   const char *name = NULL, *trace = NULL;
+   struct wl_event_loop *loop;
+   struct wl_event_source *sigint, *sigterm;
+   struct Seat *seat, *tmp;
+
+   mock.motion_rate = 1000;
+   mock.button_rate = 10;
+   mock.key_rate = 10;
+   mock.hotplug_count = 1;
+   mock.speed = 1;
+   while ((opt = getopt(argc, argv, "s:n:m:b:k:p:c:d:t:x:")) != -1)
+     {
+        switch (opt)
+          {
+           case 's': name = optarg; break;
+           case 'n': nseats = atoi(optarg); break;
+           case 'm': mock.motion_rate = atof(optarg); break;
+           case 'b': mock.button_rate = atof(optarg); break;
+           case 'k': mock.key_rate = atof(optarg); break;
+           case 'p': mock.hotplug_ms = atoi(optarg); break;
+           case 'c': mock.hotplug_count = atoi(optarg); break;
+           case 'd': mock.duration = atof(optarg); break;
+           case 't': trace = optarg; break;
+           case 'x': mock.speed = atof(optarg); break;
+           default:
+              _usage(argv[0]);
+              return 1;
+          }
+     }
+
+   EINA_SAFETY_ON_TRUE_RETURN_VAL(eina_init() == 0, r);
+   mock.pongs = eina_inarray_new(sizeof(double), 0);
+   EINA_SAFETY_ON_NULL_GOTO(mock.pongs, err_pongs);
+   mock.null_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+   EINA_SAFETY_ON_TRUE_GOTO(mock.null_fd == -1, err_null);
+
+   wl_list_init(&mock.seats);
+   wl_list_init(&mock.surfaces);
+   wl_list_init(&mock.shell_surfaces);
+   wl_list_init(&mock.frames);
+
+   mock.display = wl_display_create();
+   EINA_SAFETY_ON_NULL_GOTO(mock.display, err_display);
+   if (name)
+     {
+        EINA_SAFETY_ON_TRUE_GOTO(wl_display_add_socket(mock.display,
+                                                       name) == -1,
+                                 err_socket);
+     }
+   else
+     {
+        name = wl_display_add_socket_auto(mock.display);
+        EINA_SAFETY_ON_NULL_GOTO(name, err_socket);
+     }
+
+   EINA_SAFETY_ON_TRUE_GOTO(wl_display_init_shm(mock.display) == -1,
+                            err_socket);
+   EINA_SAFETY_ON_NULL_GOTO(wl_global_create(mock.display,
+                                             &wl_compositor_interface,
+                                             COMPOSITOR_VERSION, NULL,
+                                             _compositor_bind), err_socket);
+   EINA_SAFETY_ON_NULL_GOTO(wl_global_create(mock.display,
+                                             &wl_shell_interface,
+                                             SHELL_VERSION, NULL,
+                                             _shell_bind), err_socket);
+   if (trace)
+     {
+        if (!_trace_load(trace))
+          goto err_seats;
+        nseats = mock.replaying;
+     }
+   else
+     for (i = 0; i < nseats; i++)
+       EINA_SAFETY_ON_NULL_GOTO(_seat_add(), err_seats);
+
+   loop = wl_display_get_event_loop(mock.display);
+   mock.tick = wl_event_loop_add_timer(loop, _tick, NULL);
+   EINA_SAFETY_ON_NULL_GOTO(mock.tick, err_seats);
+   mock.frame = wl_event_loop_add_timer(loop, _frame, NULL);
+   EINA_SAFETY_ON_NULL_GOTO(mock.frame, err_seats);
+   mock.report = wl_event_loop_add_timer(loop, _report, NULL);
+   EINA_SAFETY_ON_NULL_GOTO(mock.report, err_seats);
+   /* Traced seats come and go as they did */
+   if (mock.hotplug_ms && !mock.replay)
+     {
+        mock.hotplug = wl_event_loop_add_timer(loop, _hotplug, NULL);
+        EINA_SAFETY_ON_NULL_GOTO(mock.hotplug, err_seats);
+        wl_event_source_timer_update(mock.hotplug, mock.hotplug_ms);
+     }
+   sigint = wl_event_loop_add_signal(loop, SIGINT, _sig_action, NULL);
+   EINA_SAFETY_ON_NULL_GOTO(sigint, err_seats);
+   sigterm = wl_event_loop_add_signal(loop, SIGTERM, _sig_action, NULL);
+   EINA_SAFETY_ON_NULL_GOTO(sigterm, err_sigterm);
+
+   printf("Listening on '%s' with %u seats\n", name, nseats);
+   printf("%6s %10s %8s %8s %8s %8s\n", "seats", "events/s", "pong50",
+          "pong99", "pongmax", "hotplugs");
+   fflush(stdout);
+
+   mock.start = bench_now();
+   wl_event_source_timer_update(mock.tick, TICK_MS);
+   wl_event_source_timer_update(mock.frame, FRAME_MS);
+   wl_event_source_timer_update(mock.report, REPORT_MS);
+   wl_display_run(mock.display);
+   r = 0;
+
+   wl_event_source_remove(sigterm);
+ err_sigterm:
+   wl_event_source_remove(sigint);
+ err_seats:
+   /* Client resources go first, their destructors use the seats */
+   wl_display_destroy_clients(mock.display);
+   wl_list_for_each_safe(seat, tmp, &mock.seats, link)
+     _seat_free(seat);
+ err_socket:
+   wl_display_destroy(mock.display);
+ err_display:
+   close(mock.null_fd);
+ err_null:
+   eina_inarray_free(mock.pongs);
+ err_pongs:
+   eina_shutdown();
+   return r;
+}
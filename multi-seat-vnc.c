@@ -1,5 +1,8 @@
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <Evas.h>
 #include <Ecore.h>
 #include <Evas_Engine_Buffer.h>
@@ -8,73 +11,769 @@
 #include <limits.h>
 #include <Eina.h>
 #include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/ioctl.h>
+#include <sys/epoll.h>
+#include <fcntl.h>
+#include <linux/sockios.h>
+#include <errno.h>
+#include <time.h>
+
+#include "vnc-encode.h"
+#include "vnc-cache.h"
+#include "event-log.h"
+#include "latency-hist.h"
+#include "metrics.h"
+#include "pixel.h"
+#include "vnc-record.h"
+#include "vnc-shm.h"
+#include "seat-table.h"
 
 #define WIDTH (800)
 #define HEIGHT (600)
 #define RECT_DIMEN (100)
+#define CACHE_SIZE (16 * 1024 * 1024)
+/* Recorded updates waiting for the disk, past it they are dropped */
+#define RECORD_QUEUE (64 * 1024 * 1024)
+/* Seat ids, from 1 */
+#define SEATS_MAX (65536)
+/* Frame buffers kept from seats gone for the next ones */
+#define BUFFERS_SPARE (16)
+/* No new update is started for a client while this much is still queued in
+   its socket, pending damage is merged meanwhile */
+#define SEND_QUEUE_LOW (64 * 1024)
+/* Rectangle speed in pixels per second */
+#define SPEED (600)
+/* Socket events handled per main loop wake up */
+#define IO_EVENTS (256)
+/* Input messages a seat may send per second, and at once */
+#define INPUT_RATE (1000)
+#define INPUT_BURST (250)
+/* Messages read from a client before the next one gets its turn, and
+   from all of them before the animator gets its turn */
+#define READ_SLICE (16)
+#define READ_BUDGET (512)
+/* Tiles hashed to find what a render really changed */
+#define DAMAGE_TILE (32)
+#define DAMAGE_TILES_X ((WIDTH + DAMAGE_TILE - 1) / DAMAGE_TILE)
+#define DAMAGE_TILES_Y ((HEIGHT + DAMAGE_TILE - 1) / DAMAGE_TILE)
+
+#define CURSOR_W (12)
+#define CURSOR_H (19)
+
+/* X is the outline, dots are filled with the seat colour */
+static const char *const cursor_arrow[CURSOR_H] = {
+   "X           ",
+   "XX          ",
+   "X.X         ",
+   "X..X        ",
+   "X...X       ",
+   "X....X      ",
+   "X.....X     ",
+   "X......X    ",
+   "X.......X   ",
+   "X........X  ",
+   "X.........X ",
+   "X......XXXXX",
+   "X...X..X    ",
+   "X..XX..X    ",
+   "X.X  X..X   ",
+   "XX   X..X   ",
+   "X     X..X  ",
+   "      X..X  ",
+   "       XX   "
+};
+
+static const uint32_t seat_colors[] = {
+   0xe04040, 0x40e040, 0x4080ff, 0xe0e040,
+   0xe040e0, 0x40e0e0, 0xff9020, 0xf0f0f0
+};
 
-static unsigned seat = 1;
+/* Client_Data records by seat id */
+static Seat_Table *clients = NULL;
 static rfbScreenInfoPtr server = NULL;
 static Ecore_Animator *animator = NULL;
+static Eina_List *seats = NULL;
+static int epoll_fd = -1;
+/* Where libvncserver writes the updates it encodes, see _client_capture() */
+static int capture_fd = -1;
+static Eina_List *clients_gone = NULL;
+/* Frame and encode buffers of seats gone, the next seats take them
+   instead of going back to malloc */
+static Eina_Trash *buffers_spare = NULL;
+static unsigned buffers_nspare = 0;
+/* Clients with messages left to read, taking turns */
+static Eina_List *readers = NULL;
+static Ecore_Job *readers_job = NULL;
+/* Every seat gone so far, printed on exit */
+static Latency_Hist latency_all;
+/* Damage from tile hashes rather than from what Evas rendered */
+static Eina_Bool damage_tiles = EINA_FALSE;
+
+/* Where a moving object was when the seat was last pushed, so a push can
+   tell the viewer to copy it instead of sending its pixels again. */
+struct Move {
+   Evas_Object *obj;
+   Eina_Rectangle from;
+   int r, g, b, a;
+};
+
+/* Everything a seat draws lives here: its own rfb screen (so libvncserver
+   tracks modified regions per seat), the Evas canvas rendering into the
+   seat framebuffer and the damage rendered but not yet pushed. */
+struct Seat {
+   unsigned id;
+   unsigned refs;
+   rfbScreenInfoPtr screen;
+   rfbClientRec *client;
+   char *frame_buffer;
+   /* The memfd holding frame_buffer for seats connected with -L, so their
+      viewer can map it, -1 otherwise */
+   int shm_fd;
+   Evas *evas;
+   Evas_Object *rect;
+   Eina_List *damage;
+   /* What the encoding threads read: the tiles of the update in flight,
+      copied from frame_buffer when it started */
+   char *encode_buffer;
+   /* A frame was rendered and marked while the previous one was encoded
+      or sent, it goes as soon as the client asks */
+   Eina_Bool ahead;
+   /* Hashes of the frame buffer tiles as last pushed, with -t only */
+   uint64_t *tiles;
+   struct Move move;
+   struct Update *update;
+   /* With -R, what the client was sent */
+   Record *record;
+   Event_Ring *events;
+   /* Motions are only logged once per tick, buttons right away */
+   struct {
+      Eina_Bool pending;
+      int x, y;
+   } pointer;
+   /* From an input arriving to the first frame rendered after it being
+      written to the socket, 0 while nothing is waiting */
+   struct {
+      double input;
+      double frame;
+      Latency_Hist hist;
+   } latency;
+   /* Viewers supporting cursor shapes draw it themselves, it is only
+      drawn in the frame buffer for the others */
+   struct {
+      uint32_t pixels[CURSOR_W * CURSOR_H];
+      uint32_t under[CURSOR_W * CURSOR_H];
+      /* Frame buffer area covered, empty while not drawn */
+      Eina_Rectangle at;
+      /* Where it was until hidden for rendering */
+      Eina_Rectangle hidden;
+   } cursor;
+   enum { RIGHT, LEFT } direction;
+   double anim_time;
+};
+
+struct Tile {
+   int x, y, w, h;
+   Eina_Binbuf *data;
+};
+
+/* Tiles handed to the threads together. Jobs only see their batch, so
+   batches can be added while earlier ones are encoded. */
+struct Tile_Batch {
+   unsigned ntiles;
+   struct Tile tiles[];
+};
+
+/* A framebuffer update whose tiles are being encoded by the worker threads.
+   They read a copy of the tiles, so the seat can render its next frame
+   meanwhile. Until it is sent no client message is read, so the client
+   format stays put. */
+struct Update {
+   struct Seat *seat;
+   struct Encode_Format format;
+   int encoding;
+   Eina_Binbuf *copies;
+   unsigned ncopies;
+   /* Cursor shape and position */
+   Eina_Binbuf *pseudo;
+   unsigned npseudo;
+   /* Where the viewer maps the frame buffer: the changed rectangles,
+      nothing is encoded */
+   Eina_Bool shm;
+   Eina_Binbuf *damage;
+   unsigned ndamage;
+   /* Carries the memfd along, see vnc-shm.h */
+   Eina_Bool pass_fd;
+   Eina_List *batches;
+   unsigned ntiles;
+   unsigned njobs;
+   unsigned done;
+   Eina_Bool failed;
+   /* Covers the whole screen without copies, for the recording */
+   Eina_Bool keyframe;
+   uint64_t encode_nsec;
+   /* Opened before the render, see _update_stream_begin() */
+   struct {
+      Eina_Bool open;
+      sraRegionPtr requested;
+      /* Still changing once the canvas is rendered */
+      sraRegionPtr held;
+      sraRegionPtr sent;
+   } stream;
+};
+
+struct Update_Job {
+   struct Update *update;
+   const struct Tile_Batch *batch;
+   unsigned first, step;
+   Eina_Bool failed;
+   /* Time spent encoding, added to the update when the job ends */
+   uint64_t nsec;
+};
+
+/* Listening and client sockets are all in one edge triggered epoll set,
+   every event points to one of these. */
+struct Io {
+   enum { IO_LISTEN, IO_LISTEN_LOCAL, IO_CLIENT, IO_METRICS } type;
+   int fd;
+};
 
 struct Client_Data {
-   unsigned seat;
-   Ecore_Fd_Handler *fd_handler;
+   struct Io io;
+   /* Of the seat, the record goes back to the table with it */
+   unsigned id;
+   rfbClientRec *client;
+   struct Seat *seat;
+   /* Got a read edge, some of it may still be waiting */
+   Eina_Bool readable;
+   /* In readers */
+   Eina_Bool queued;
+   /* Input tokens, refilled at INPUT_RATE up to INPUT_BURST */
+   double tokens;
+   double tokens_time;
+   /* Nothing is read until a token is there */
+   Ecore_Timer *throttle;
+   /* The message waiting for it was counted as throttled already */
+   Eina_Bool held;
+   /* Update bytes the socket did not take yet */
+   Eina_Binbuf *out;
+   size_t out_sent;
+   /* Passed along the first byte of out, -1 for none */
+   int out_fd;
+   /* The viewer maps the seat frame buffer, the memfd was sent to it */
+   Eina_Bool shm;
+   Eina_Bool shm_sent;
+   Metrics metrics;
 };
 
+/* RFB input has no time of its own */
+static uint32_t
+_input_time(void)
+{
+   return (uint32_t)(ecore_time_get() * 1000);
+}
+
+static void
+_seat_pointer_flush(struct Seat *s)
+{
+   if (!s->pointer.pending)
+     return;
+   event_log_push(s->events, EVENT_POINTER_MOTION, _input_time(),
+                  s->pointer.x, s->pointer.y);
+   s->pointer.pending = EINA_FALSE;
+}
+
 static void
 _client_gone(rfbClientRec *client)
 {
    struct Client_Data *cd;
+   char label[64];
 
    cd = client->clientData;
-   seat--;
-   printf("Client on seat '%u' is gone\n", cd->seat);
-   ecore_main_fd_handler_del(cd->fd_handler);
-   free(cd);
+   printf("Client on seat '%u' is gone\n", cd->seat->id);
+   snprintf(label, sizeof(label), "Seat '%u' input to update",
+            cd->seat->id);
+   latency_hist_print(&cd->seat->latency.hist, stdout, label);
+   latency_hist_merge(&latency_all, &cd->seat->latency.hist);
+   metrics_seat_del(&cd->metrics);
+   cd->seat->client = NULL;
+   if (cd->seat->record)
+     record_close(cd->seat->record);
+   cd->seat->record = NULL;
+   _seat_pointer_flush(cd->seat);
+   event_log_ring_close(cd->seat->events);
+   cd->seat->events = NULL;
+   cd->client = NULL;
+   if (cd->out)
+     eina_binbuf_free(cd->out);
+   cd->out = NULL;
+   if (cd->throttle)
+     ecore_timer_del(cd->throttle);
+   cd->throttle = NULL;
+   if (cd->queued)
+     readers = eina_list_remove(readers, cd);
+   cd->queued = EINA_FALSE;
+   /* Closing the socket took it out of the epoll set, but events already
+      fetched may still point here */
+   clients_gone = eina_list_append(clients_gone, cd);
+}
+
+static void _seat_free(struct Seat *s);
+static void _reader_add(struct Client_Data *cd);
+static void _seat_schedule(struct Seat *s);
+static void _update_stream_region(struct Update *u, int x, int y, int w,
+                                  int h);
+
+/* Only the oldest input waiting counts, the ones after it are reflected
+   by the same frame */
+static void
+_seat_input_stamp(struct Seat *s)
+{
+   if (!s->latency.input)
+     s->latency.input = ecore_time_get();
+}
+
+/* The frame carrying the input is now in the socket */
+static void
+_seat_frame_sent(struct Seat *s)
+{
+   if (!s->latency.frame)
+     return;
+   latency_hist_record(&s->latency.hist,
+                       ecore_time_get() - s->latency.frame);
+   s->latency.frame = 0;
+}
+
+static void
+_client_drop(rfbClientRec *client)
+{
+   struct Client_Data *cd = client->clientData;
+   struct Seat *s = cd->seat;
+
+   rfbClientConnectionGone(client);
+   _seat_free(s);
+}
+
+/* The descriptor goes with the first byte sent, which is all it needs */
+static ssize_t
+_client_send_fd(int sock, const unsigned char *data, size_t len, int fd)
+{
+   union {
+      struct cmsghdr hdr;
+      char buf[CMSG_SPACE(sizeof(int))];
+   } control;
+   struct iovec iov = { (void *)data, len };
+   struct msghdr msg = { 0 };
+   struct cmsghdr *cmsg;
+
+   memset(&control, 0, sizeof(control));
+   msg.msg_iov = &iov;
+   msg.msg_iovlen = 1;
+   msg.msg_control = control.buf;
+   msg.msg_controllen = sizeof(control.buf);
+   cmsg = CMSG_FIRSTHDR(&msg);
+   cmsg->cmsg_level = SOL_SOCKET;
+   cmsg->cmsg_type = SCM_RIGHTS;
+   cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+   memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+   return sendmsg(sock, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+}
+
+/* Writes what the socket takes without blocking, returns -1 on error */
+static int
+_client_flush(rfbClientRec *client)
+{
+   struct Client_Data *cd = client->clientData;
+   const unsigned char *data;
+   size_t len;
+   ssize_t n;
+
+   if (!cd->out)
+     return 0;
+
+   data = eina_binbuf_string_get(cd->out);
+   len = eina_binbuf_length_get(cd->out);
+   metrics_set(&cd->metrics, METRIC_QUEUED_BYTES, len - cd->out_sent);
+   while (cd->out_sent < len)
+     {
+        if (cd->out_fd != -1)
+          n = _client_send_fd(client->sock, data + cd->out_sent,
+                              len - cd->out_sent, cd->out_fd);
+        else
+          n = send(client->sock, data + cd->out_sent, len - cd->out_sent,
+                   MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (n < 0)
+          {
+             if (errno == EINTR)
+               continue;
+             if (errno == EAGAIN || errno == EWOULDBLOCK)
+               return 0;
+             return -1;
+          }
+        cd->out_sent += n;
+        cd->out_fd = -1;
+        metrics_add(&cd->metrics, METRIC_BYTES_SENT, n);
+        metrics_set(&cd->metrics, METRIC_QUEUED_BYTES, len - cd->out_sent);
+     }
+
+   eina_binbuf_free(cd->out);
+   cd->out = NULL;
+   cd->out_sent = 0;
+   return 0;
+}
+
+/* Takes msg over */
+static int
+_client_queue(rfbClientRec *client, Eina_Binbuf *msg)
+{
+   struct Client_Data *cd = client->clientData;
+   Eina_Bool r;
+
+   if (cd->out)
+     {
+        r = eina_binbuf_append_buffer(cd->out, msg);
+        eina_binbuf_free(msg);
+        if (!r)
+          return -1;
+     }
+   else
+     cd->out = msg;
+   return _client_flush(client);
 }
 
+/* A client still draining its previous update is skipped, so a slow link
+   only delays its own seat. Its damage keeps piling in the modified
+   region and goes in the next update it can take. */
 static Eina_Bool
-_client_activity(void *data, Ecore_Fd_Handler *fd_handler)
+_client_send_ready(rfbClientRec *client)
+{
+   struct Client_Data *cd = client->clientData;
+   int queued;
+
+   if (cd->out)
+     return EINA_FALSE;
+   if (ioctl(client->sock, SIOCOUTQ, &queued) == 0 &&
+       queued > SEND_QUEUE_LOW)
+     return EINA_FALSE;
+   return EINA_TRUE;
+}
+
+/* rfbWriteExact() waits for a full socket, seconds at a time. Updates of
+   the clients libvncserver encodes go to a memfd instead, which never
+   fills up, and from there in the queue like the others. */
+static int
+_client_capture(rfbClientRec *client)
 {
-   rfbClientRec *client = data;
+   struct Client_Data *cd = client->clientData;
+   unsigned char *data;
+   Eina_Binbuf *msg;
+   int sock = client->sock;
+   off_t len;
 
-   rfbProcessClientMessage(client);
+   if (capture_fd == -1)
+     capture_fd = memfd_create("multi-seat-vnc-capture", MFD_CLOEXEC);
+   if (capture_fd == -1)
+     return -1;
+
+   client->sock = capture_fd;
+   rfbUpdateClient(client);
+   /* A failed write closed the memfd rather than the client */
    if (client->sock == -1)
      {
-        rfbClientConnectionGone(client);
-        return ECORE_CALLBACK_DONE;
+        capture_fd = -1;
+        client->sock = sock;
+        return -1;
      }
-   return ECORE_CALLBACK_RENEW;
+   client->sock = sock;
+
+   len = lseek(capture_fd, 0, SEEK_CUR);
+   if (len <= 0)
+     return len;
+   data = malloc(len);
+   if (!data)
+     goto err;
+   if (pread(capture_fd, data, len, 0) != len)
+     goto err_read;
+   msg = eina_binbuf_manage_new(data, len, EINA_FALSE);
+   if (!msg)
+     goto err_read;
+   lseek(capture_fd, 0, SEEK_SET);
+   ftruncate(capture_fd, 0);
+   /* Whatever libvncserver encodes can not be cut in keyframes */
+   if (cd->seat->record)
+     record_gap(cd->seat->record, RECORD_GAP_LIBVNCSERVER, len);
+   return _client_queue(client, msg);
+
+ err_read:
+   free(data);
+ err:
+   lseek(capture_fd, 0, SEEK_SET);
+   ftruncate(capture_fd, 0);
+   return -1;
+}
+
+static Eina_Bool
+_client_throttle_end(void *data)
+{
+   struct Client_Data *cd = data;
+
+   cd->throttle = NULL;
+   _reader_add(cd);
+   return ECORE_CALLBACK_CANCEL;
+}
+
+/* Input messages take a token. Without one the client is not read until
+   the next one is there: its socket fills up and TCP slows the sender
+   down, a flood only delays its own seat. */
+static Eina_Bool
+_client_input_take(struct Client_Data *cd)
+{
+   double now = ecore_time_get();
+
+   cd->tokens += (now - cd->tokens_time) * INPUT_RATE;
+   if (cd->tokens > INPUT_BURST)
+     cd->tokens = INPUT_BURST;
+   cd->tokens_time = now;
+   if (cd->tokens >= 1)
+     {
+        cd->tokens--;
+        cd->held = EINA_FALSE;
+        return EINA_TRUE;
+     }
+
+   /* A timer a bit early peeks at the same message again */
+   if (!cd->held)
+     metrics_add(&cd->metrics, METRIC_INPUT_THROTTLED, 1);
+   cd->held = EINA_TRUE;
+   cd->throttle = ecore_timer_add((1 - cd->tokens) / INPUT_RATE,
+                                  _client_throttle_end, cd);
+   /* Better late than stuck */
+   return !cd->throttle;
+}
+
+/* Processes up to READ_SLICE messages already received, then lets the
+   other clients have their turn. Nothing is read while an update is
+   encoded or queued: libvncserver writes replies straight to the socket
+   and they must not get in the middle of an update. Returns how many
+   messages were processed. */
+static unsigned
+_client_read(struct Client_Data *cd)
+{
+   rfbClientRec *client = cd->client;
+   unsigned count = 0;
+   ssize_t n;
+   unsigned char c;
+
+   while (cd->readable && !cd->throttle && !cd->seat->update && !cd->out)
+     {
+        if (count == READ_SLICE)
+          {
+             _reader_add(cd);
+             break;
+          }
+        n = recv(client->sock, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+        if (n < 0 && errno == EINTR)
+          continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+          {
+             cd->readable = EINA_FALSE;
+             break;
+          }
+        if (n == 1 && client->state == RFB_NORMAL &&
+            (c == rfbPointerEvent || c == rfbKeyEvent) &&
+            !_client_input_take(cd))
+          break;
+        /* Errors and end of stream are found out by libvncserver */
+        rfbProcessClientMessage(client);
+        count++;
+        if (client->sock == -1)
+          {
+             _client_drop(client);
+             return count;
+          }
+     }
+   /* It may have asked for an update or be able to take one again */
+   _seat_schedule(cd->seat);
+   return count;
+}
+
+/* Round robin over the clients with messages left, a slice each, until
+   the budget is spent. What is left waits for the next job, after the
+   animator and the socket events of this loop iteration. */
+static void
+_readers_run(void *data)
+{
+   struct Client_Data *cd;
+   unsigned budget = READ_BUDGET, n;
+
+   readers_job = NULL;
+   while (readers && budget)
+     {
+        cd = eina_list_data_get(readers);
+        readers = eina_list_remove_list(readers, readers);
+        cd->queued = EINA_FALSE;
+        n = _client_read(cd);
+        budget -= n < budget ? n : budget;
+     }
+   if (readers && !readers_job)
+     readers_job = ecore_job_add(_readers_run, NULL);
+}
+
+static void
+_reader_add(struct Client_Data *cd)
+{
+   if (cd->queued || !cd->client)
+     return;
+   readers = eina_list_append(readers, cd);
+   cd->queued = EINA_TRUE;
+   if (!readers_job)
+     readers_job = ecore_job_add(_readers_run, NULL);
+}
+
+static void
+_client_io(struct Client_Data *cd, uint32_t events)
+{
+   rfbClientRec *client = cd->client;
+
+   /* Gone while handling an earlier event */
+   if (!client)
+     return;
+
+   if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+     cd->readable = EINA_TRUE;
+   if (cd->out && (events & (EPOLLOUT | EPOLLHUP | EPOLLERR)))
+     {
+        if (_client_flush(client) < 0)
+          {
+             rfbCloseClient(client);
+             _client_drop(client);
+             return;
+          }
+        if (!cd->out)
+          _seat_frame_sent(cd->seat);
+     }
+   _reader_add(cd);
+}
+
+static uint32_t
+_seat_color(const struct Seat *s)
+{
+   return seat_colors[s->id % EINA_C_ARRAY_LENGTH(seat_colors)];
+}
+
+static void
+_seat_cursor_make(struct Seat *s)
+{
+   uint32_t color = 0xff000000 | _seat_color(s), p;
+   char source[CURSOR_W * CURSOR_H + 1], mask[CURSOR_W * CURSOR_H + 1];
+   rfbCursorPtr c;
+   int x, y;
+
+   for (y = 0; y < CURSOR_H; y++)
+     for (x = 0; x < CURSOR_W; x++)
+       {
+          switch (cursor_arrow[y][x])
+            {
+             case 'X': p = 0xff000000; break;
+             case '.': p = color; break;
+             default: p = 0; break;
+            }
+          s->cursor.pixels[y * CURSOR_W + x] = p;
+          source[y * CURSOR_W + x] = cursor_arrow[y][x] == '.' ? 'x' : ' ';
+          mask[y * CURSOR_W + x] = cursor_arrow[y][x] == ' ' ? ' ' : 'x';
+       }
+   source[CURSOR_W * CURSOR_H] = mask[CURSOR_W * CURSOR_H] = '\0';
+
+   /* The same shape for the clients libvncserver updates, the seat colour
+      in front and the outline behind. rfbScreenCleanup() frees it. */
+   c = rfbMakeXCursor(CURSOR_W, CURSOR_H, source, mask);
+   EINA_SAFETY_ON_NULL_RETURN(c);
+   c->foreRed = (color >> 16 & 0xff) * 257;
+   c->foreGreen = (color >> 8 & 0xff) * 257;
+   c->foreBlue = (color & 0xff) * 257;
+   c->backRed = c->backGreen = c->backBlue = 0;
+   rfbSetCursor(s->screen, c);
 }
 
 static enum rfbNewClientAction
 _new_client(rfbClientRec *client)
 {
    struct Client_Data *cd;
+   struct Seat *s = client->screen->screenData;
+   struct epoll_event ev;
+   char name[16];
+   unsigned id;
+   int r;
 
-   if (seat == UINT_MAX)
+   cd = seat_table_add(clients, &id);
+   if (!cd)
      {
-        printf("Max clients");
+        printf("Max clients, %u connected\n", seat_table_count(clients));
         return RFB_CLIENT_REFUSE;
      }
-
-   cd = malloc(sizeof(struct Client_Data));
-   EINA_SAFETY_ON_NULL_RETURN_VAL(cd, RFB_CLIENT_REFUSE);
+   cd->id = id;
+   snprintf(name, sizeof(name), "%u", id);
+   s->events = event_log_ring_new(name);
+   EINA_SAFETY_ON_NULL_GOTO(s->events, err_events);
+   cd->io.type = IO_CLIENT;
+   cd->io.fd = client->sock;
+   cd->client = client;
+   cd->out_fd = -1;
+   cd->tokens = INPUT_BURST;
+   cd->tokens_time = ecore_time_get();
+   /* Write edges only matter while an update is queued, they are cheaper
+      to ignore than to toggle */
+   ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+   ev.data.ptr = &cd->io;
+   r = epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client->sock, &ev);
+   EINA_SAFETY_ON_TRUE_GOTO(r == -1, err_handler);
+   /* Only hook once accepted, a refused client is released right away */
    client->clientData = cd;
    client->clientGoneHook = _client_gone;
-   cd->fd_handler = ecore_main_fd_handler_add(client->sock, ECORE_FD_READ,
-                                          _client_activity, client, NULL, NULL);
-   EINA_SAFETY_ON_NULL_GOTO(cd->fd_handler, err_handler);
-   printf("New client attached to seat '%u'\n", seat);
-   cd->seat = seat++;
+   printf("New client attached to seat '%u'\n", id);
+   metrics_seat_add(&cd->metrics, name);
+   cd->seat = s;
+   s->client = client;
+   s->id = id;
+   s->record = record_open(s->id, WIDTH, HEIGHT);
+   _seat_cursor_make(s);
    return RFB_CLIENT_ACCEPT;
 
  err_handler:
-   free(cd);
+   event_log_ring_close(s->events);
+   s->events = NULL;
+ err_events:
+   seat_table_del(clients, id);
    return RFB_CLIENT_REFUSE;
 }
 
+/* Viewers ask for the shared frame buffer in SetEncodings, only those on
+   the local socket get it */
+static rfbBool
+_shm_enable(rfbClientRec *client, void **data, int encoding)
+{
+   struct Client_Data *cd = client->clientData;
+
+   if (encoding != SHM_ENCODING)
+     return FALSE;
+   if (cd->seat->shm_fd != -1)
+     cd->shm = EINA_TRUE;
+   /* Known either way, remote viewers keep getting pixels */
+   return TRUE;
+}
+
+static int shm_encodings[] = { SHM_ENCODING, 0 };
+
+static rfbProtocolExtension shm_extension = {
+   .pseudoEncodings = shm_encodings,
+   .enablePseudoEncoding = _shm_enable
+};
+
 static void
 _keyboard_event(rfbBool down, rfbKeySym keySym, rfbClientRec *client)
 {
@@ -82,12 +781,9 @@ _keyboard_event(rfbBool down, rfbKeySym keySym, rfbClientRec *client)
 
    cd = client->clientData;
 
-   if (!down)
-       printf("The client on seat '%u' pressed the key '%"PRIu32"'\n",
-              cd->seat, keySym);
-   else
-       printf("The client on seat '%u' released the key '%"PRIu32"'\n",
-              cd->seat, keySym);
+   _seat_input_stamp(cd->seat);
+   metrics_add(&cd->metrics, METRIC_EVENTS, 1);
+   event_log_push(cd->seat->events, EVENT_KEY, _input_time(), keySym, down);
 
    if (keySym == XK_Escape || keySym =='q' || keySym =='Q')
      rfbCloseClient(client);
@@ -108,27 +804,93 @@ _pointer_event(int buttonMask, int x, int y, rfbClientPtr client)
 {
    int button, buttonChanged;
    struct Client_Data *cd;
+   struct Seat *s;
 
    cd = client->clientData;
+   s = cd->seat;
+   _seat_input_stamp(s);
+   metrics_add(&cd->metrics, METRIC_EVENTS, 1);
 
    /* Apparently lastPtrX and Y wasn't updated, so maybe we need
       to keep positions on the program side. */
-   printf("The client's cursor on seat '%u' is at X: %d Y: %d\n",
-           cd->seat, x, y);
+   s->pointer.x = x;
+   s->pointer.y = y;
+   s->pointer.pending = EINA_TRUE;
+   /* The viewer moved it, there is nothing to tell it back */
+   s->screen->cursorX = x;
+   s->screen->cursorY = y;
+   client->cursorWasMoved = FALSE;
+   /* Traces replay every motion, not one per tick */
+   if (event_log_tracing())
+     _seat_pointer_flush(s);
    /* Check if a mouse button was pressed or released */
    buttonChanged = buttonMask - client->lastPtrButtons;
+   if (!buttonChanged)
+     return;
+
+   /* Where the button changed is logged first */
+   _seat_pointer_flush(s);
    if (buttonChanged > 0) {
        button = _get_button(buttonChanged);
-       printf("The client on seat '%u' pressed button: %d\n", cd->seat, button);
+       event_log_push(cd->seat->events, EVENT_POINTER_BUTTON, _input_time(),
+                      button, 1);
    } else if (buttonChanged < 0) {
        button = _get_button(-buttonChanged);
-       printf("The client on seat '%u' released button: %d\n", cd->seat,
-              button);
+       event_log_push(cd->seat->events, EVENT_POINTER_BUTTON, _input_time(),
+                      button, 0);
    }
 }
 
+/* Runs on the logging thread */
+static void
+_event_print(const char *seat, const struct Event_Record *ev)
+{
+   switch (ev->type)
+     {
+      case EVENT_POINTER_MOTION:
+         printf("The client's cursor on seat '%s' is at X: %d Y: %d\n",
+                seat, ev->a, ev->b);
+         break;
+      case EVENT_POINTER_BUTTON:
+         printf("The client on seat '%s' %s button: %d\n", seat,
+                ev->b ? "pressed" : "released", ev->a);
+         break;
+      case EVENT_KEY:
+         printf("The client on seat '%s' %s the key '%"PRIu32"'\n", seat,
+                ev->b ? "pressed" : "released", (uint32_t)ev->a);
+         break;
+     }
+}
+
+/* The callbacks of the buffer engine only get the region, this is whose
+   canvas is being rendered */
+static struct Seat *rendering = NULL;
+
+/* Evas renders each region in an image of its own, about the size of the
+   region, and copies it here once done */
+static void *
+_region_new(int x, int y, int w, int h, int *row_bytes)
+{
+   if (!rendering)
+     return NULL;
+   *row_bytes = WIDTH * 4;
+   return (uint32_t *)rendering->frame_buffer + y * WIDTH + x;
+}
+
+static void
+_region_free(int x, int y, int w, int h, void *data)
+{
+   struct Update *u;
+
+   if (!rendering)
+     return;
+   u = rendering->update;
+   if (u && u->stream.open)
+     _update_stream_region(u, x, y, w, h);
+}
+
 static Evas *
-_create_evas_frame(void *pixels)
+_create_evas_frame(void)
 {
    Evas *evas;
    Evas_Engine_Info_Buffer *einfo;
@@ -148,12 +910,13 @@ _create_evas_frame(void *pixels)
    EINA_SAFETY_ON_NULL_GOTO(einfo, err_einfo);
 
    einfo->info.depth_type = EVAS_ENGINE_BUFFER_DEPTH_ARGB32;
-   einfo->info.dest_buffer = pixels;
+   /* Without a destination every region goes through the callbacks */
+   einfo->info.dest_buffer = NULL;
    einfo->info.dest_buffer_row_bytes = WIDTH * sizeof(int);
    einfo->info.use_color_key = 0;
    einfo->info.alpha_threshold = 0;
-   einfo->info.func.new_update_region = NULL;
-   einfo->info.func.free_update_region = NULL;
+   einfo->info.func.new_update_region = _region_new;
+   einfo->info.func.free_update_region = _region_free;
    evas_engine_info_set(evas, (Evas_Engine_Info *)einfo);
 
    return evas;
@@ -163,26 +926,27 @@ _create_evas_frame(void *pixels)
    return NULL;
 }
 
-static Eina_Bool
-_anim(void *data)
+static void
+_seat_animate(struct Seat *s)
 {
-   rfbClientIteratorPtr itr;
-   rfbClientRec *client;
-   static enum { RIGHT, LEFT } direction = LEFT;
-   static const int speed = 20;
-   int x, y;
-   Evas_Object *rect = data;
-   Eina_List *updates, *n;
-   Eina_Rectangle *update;
+   double now = ecore_loop_time_get();
+   int x, y, speed;
 
-   evas_object_geometry_get(rect, &x, &y, NULL, NULL);
-   if (direction == LEFT)
+   /* Seats are rendered at the pace of their client, the rectangle moves
+      with time rather than per frame */
+   speed = (now - s->anim_time) * SPEED;
+   if (!speed)
+     return;
+   s->anim_time = now;
+
+   evas_object_geometry_get(s->rect, &x, &y, NULL, NULL);
+   if (s->direction == LEFT)
      {
         x -= speed;
         if (x <= 0)
           {
              x = 0;
-             direction = RIGHT;
+             s->direction = RIGHT;
           }
      }
    else
@@ -190,139 +954,1553 @@ _anim(void *data)
         x += speed;
         if (x >= WIDTH)
           {
-             direction = LEFT;
+             s->direction = LEFT;
              x = WIDTH;
           }
      }
 
-   evas_object_move(rect, x, y);
+   evas_object_move(s->rect, x, y);
+}
 
-   updates = evas_render_updates(evas_object_evas_get(rect));
-   EINA_LIST_FOREACH(updates, n, update)
-      rfbMarkRectAsModified(server, update->x, update->y, update->w, update->h);
-   evas_render_updates_free(updates);
+/* The zlib based encodings are left to libvncserver */
+static Eina_Bool
+_client_encodable(const rfbClientRec *client)
+{
+   return encode_supported(client->preferredEncoding) &&
+      client->format.trueColour &&
+      !(client->useNewFBSize && client->newFBSizePending);
+}
 
-   itr = rfbGetClientIterator(server);
-   while ((client = rfbClientIteratorNext(itr)) != NULL) {
-      rfbUpdateClient(client);
+/* The viewer maps the frame buffer and reads it as is */
+static Eina_Bool
+_client_shm(const rfbClientRec *client)
+{
+   const struct Client_Data *cd = client->clientData;
+   struct Encode_Format f;
 
-      if (client->sock == -1)
-         rfbClientConnectionGone(client);
-   }
-   rfbReleaseClientIterator(itr);
+   if (!cd->shm)
+     return EINA_FALSE;
+   encode_format_set(&f, &client->screen->serverFormat, &client->format);
+   return f.identity;
+}
 
-   return ECORE_CALLBACK_RENEW;
+static void
+_seat_damage_add(struct Seat *s, const Eina_Rectangle *r)
+{
+   Eina_Rectangle *d;
+
+   d = eina_rectangle_new(r->x, r->y, r->w, r->h);
+   EINA_SAFETY_ON_NULL_RETURN(d);
+   s->damage = eina_list_append(s->damage, d);
 }
 
-static int
-_draw_objects(Evas *evas)
+/* Puts back what the cursor covered, Evas expects its own pixels there */
+static void
+_seat_cursor_hide(struct Seat *s)
 {
-   Evas_Object *bg, *txt, *rect;
+   Eina_Rectangle *at = &s->cursor.at;
 
-   bg = evas_object_rectangle_add(evas);
-   EINA_SAFETY_ON_NULL_RETURN_VAL(bg, -1);
-   evas_object_color_set(bg, 255, 255, 255, 255);
-   evas_object_move(bg, 0, 0);
-   evas_object_resize(bg, WIDTH, HEIGHT);
-   evas_object_show(bg);
+   s->cursor.hidden = *at;
+   if (eina_rectangle_is_empty(at))
+     return;
+   pixel_blit((uint32_t *)s->frame_buffer + at->y * WIDTH + at->x, WIDTH,
+              s->cursor.under, CURSOR_W, at->w, at->h);
+   EINA_RECTANGLE_SET(at, 0, 0, 0, 0);
+}
 
-   txt = evas_object_text_add(evas);
-   EINA_SAFETY_ON_NULL_RETURN_VAL(txt, -1);
-   evas_object_color_set(txt, 0, 0, 0, 255);
-   evas_object_text_style_set(txt, EVAS_TEXT_STYLE_PLAIN);
-   evas_object_text_font_set(txt, "Sans", 15);
-   evas_object_text_text_set(txt,
-      "Move your mouse and press your keyboard keys. Press ESC to exit. ");
-   evas_object_move(txt, 0, 0);
-   evas_object_show(txt);
+/* Draws the cursor over the rendered frame for a viewer which does not
+   draw it itself. Drawn in the same place it gives the same pixels, only
+   a move damages anything: where it was and where it is. */
+static Eina_Bool
+_seat_cursor_show(struct Seat *s)
+{
+   Eina_Rectangle *at = &s->cursor.at, frame, *was = &s->cursor.hidden;
+   uint32_t *fb = (uint32_t *)s->frame_buffer;
+   int sx, sy;
 
-   rect = evas_object_rectangle_add(evas);
-   EINA_SAFETY_ON_NULL_RETURN_VAL(rect, -1);
-   evas_object_color_set(rect, 255, 0, 0, 255);
-   evas_object_resize(rect, RECT_DIMEN, RECT_DIMEN);
-   evas_object_move(rect, (WIDTH - RECT_DIMEN) /2, (HEIGHT- RECT_DIMEN)/2);
-   evas_object_show(rect);
+   /* libvncserver draws its own for the viewers it encodes for */
+   if (_client_encodable(s->client) &&
+       !s->client->enableCursorShapeUpdates)
+     {
+        EINA_RECTANGLE_SET(at, s->pointer.x, s->pointer.y,
+                           CURSOR_W, CURSOR_H);
+        EINA_RECTANGLE_SET(&frame, 0, 0, WIDTH, HEIGHT);
+        if (!eina_rectangle_intersection(at, &frame))
+          EINA_RECTANGLE_SET(at, 0, 0, 0, 0);
+        /* What the viewer shows, FB_UPDATE_PENDING() looks at it */
+        s->client->cursorX = s->pointer.x;
+        s->client->cursorY = s->pointer.y;
+     }
+   if (!eina_rectangle_is_empty(at))
+     {
+        sx = at->x - s->pointer.x;
+        sy = at->y - s->pointer.y;
+        pixel_blit(s->cursor.under, CURSOR_W,
+                   fb + at->y * WIDTH + at->x, WIDTH, at->w, at->h);
+        pixel_over(fb + at->y * WIDTH + at->x, WIDTH,
+                   s->cursor.pixels + sy * CURSOR_W + sx, CURSOR_W,
+                   at->w, at->h);
+     }
 
-   animator = ecore_animator_add(_anim, rect);
-   EINA_SAFETY_ON_NULL_RETURN_VAL(animator, -1);
+   if (at->x == was->x && at->y == was->y && at->w == was->w &&
+       at->h == was->h)
+     return EINA_FALSE;
+   if (!eina_rectangle_is_empty(was))
+     _seat_damage_add(s, was);
+   if (!eina_rectangle_is_empty(at))
+     _seat_damage_add(s, at);
+   return EINA_TRUE;
+}
 
-   return 0;
+/* Renders the seat canvas, keeping what changed until it is pushed.
+   Returns EINA_FALSE if nothing had to be drawn. */
+static Eina_Bool
+_seat_render(struct Seat *s)
+{
+   Eina_List *updates;
+
+   rendering = s;
+   updates = evas_render_updates(s->evas);
+   rendering = NULL;
+   if (!updates)
+     return EINA_FALSE;
+   s->damage = eina_list_merge(s->damage, updates);
+   return EINA_TRUE;
 }
 
 static void
-_sig_action(int signum)
+_move_track(struct Move *m, Evas_Object *obj)
 {
-   ecore_main_loop_quit();
+   m->obj = obj;
+   evas_object_geometry_get(obj, &m->from.x, &m->from.y, &m->from.w,
+                            &m->from.h);
+   evas_object_color_get(obj, &m->r, &m->g, &m->b, &m->a);
 }
 
+/* Finds out if the tracked object was only translated since the last push,
+   filling the on screen area that can be copied from where it was.
+   That only holds for an opaque object which kept its size and color and
+   has nothing stacked above it over its old or new position. */
 static Eina_Bool
-_socket_activity(void *data, Ecore_Fd_Handler *fd_handler)
+_move_translation_get(const struct Move *m, Eina_Rectangle *dst,
+                      int *dx, int *dy)
 {
-   rfbProcessNewConnection(data);
-   return ECORE_CALLBACK_RENEW;
-}
+   Eina_Rectangle to, src, area, above;
+   Evas_Object *o;
+   int r, g, b, a;
 
-int
-main(int argc, char *argv[])
-{
-   Evas *evas;
-   int r = -1;
-   Ecore_Fd_Handler *fd_handler, *fd_handler6;
-   struct sigaction sa;
+   if (!m->obj)
+     return EINA_FALSE;
 
-   sa.sa_handler = _sig_action;
-   sigemptyset(&sa.sa_mask);
-   sa.sa_flags = SA_RESETHAND;
-   sigaction(SIGINT, &sa, NULL);
+   evas_object_geometry_get(m->obj, &to.x, &to.y, &to.w, &to.h);
+   evas_object_color_get(m->obj, &r, &g, &b, &a);
+   if ((to.x == m->from.x && to.y == m->from.y) ||
+       to.w != m->from.w || to.h != m->from.h ||
+       r != m->r || g != m->g || b != m->b || a != m->a || a != 255)
+     return EINA_FALSE;
 
-   EINA_SAFETY_ON_TRUE_RETURN_VAL(evas_init() == 0, -1);
-   EINA_SAFETY_ON_TRUE_GOTO(ecore_init() == 0, err_ecore);
+   area = to;
+   eina_rectangle_union(&area, &m->from);
+   for (o = evas_object_above_get(m->obj); o; o = evas_object_above_get(o))
+     {
+        if (!evas_object_visible_get(o))
+          continue;
+        evas_object_geometry_get(o, &above.x, &above.y, &above.w, &above.h);
+        if (eina_rectangles_intersect(&area, &above))
+          return EINA_FALSE;
+     }
 
-   server = rfbGetScreen(&argc, argv, WIDTH, HEIGHT, 8, 3, 4);
-   EINA_SAFETY_ON_NULL_GOTO(server, err_server);
+   /* Both the destination and its source must be on screen */
+   *dx = to.x - m->from.x;
+   *dy = to.y - m->from.y;
+   EINA_RECTANGLE_SET(dst, 0, 0, WIDTH, HEIGHT);
+   if (!eina_rectangle_intersection(dst, &to))
+     return EINA_FALSE;
+   EINA_RECTANGLE_SET(&src, 0, 0, WIDTH, HEIGHT);
+   if (!eina_rectangle_intersection(&src, &m->from))
+     return EINA_FALSE;
+   src.x += *dx;
+   src.y += *dy;
+   return eina_rectangle_intersection(dst, &src);
+}
 
-   server->frameBuffer = malloc(WIDTH * HEIGHT * 4);
-   EINA_SAFETY_ON_NULL_GOTO(server->frameBuffer, err_buffer);
+/* Both are fully written before being read, what a buffer held for the
+   previous seat never shows */
+static char *
+_buffer_get(void)
+{
+   if (!buffers_nspare)
+     return malloc(WIDTH * HEIGHT * 4);
+   buffers_nspare--;
+   return eina_trash_pop(&buffers_spare);
+}
 
-   evas = _create_evas_frame(server->frameBuffer);
-   EINA_SAFETY_ON_NULL_GOTO(evas, err_evas);
+static void
+_buffer_put(char *data)
+{
+   if (!data)
+     return;
+   if (buffers_nspare == BUFFERS_SPARE)
+     {
+        free(data);
+        return;
+     }
+   eina_trash_push(&buffers_spare, data);
+   buffers_nspare++;
+}
 
-   r = _draw_objects(evas);
-   EINA_SAFETY_ON_TRUE_GOTO(r == -1, err_draw);
-   evas_render_updates_free(evas_render_updates(evas));
+static void
+_buffers_spare_free(void)
+{
+   void *data;
 
-   server->newClientHook = _new_client;
-   server->kbdAddEvent = _keyboard_event;
-   server->ptrAddEvent = _pointer_event;
-   server->alwaysShared = TRUE;
+   while ((data = eina_trash_pop(&buffers_spare)))
+     free(data);
+   buffers_nspare = 0;
+}
 
-   rfbInitServer(server);
+/* Local seats render in a memfd, so the viewer maps what is drawn. It
+   is never recycled, the previous viewer may still have it mapped. */
+static Eina_Bool
+_seat_buffer_new(struct Seat *s, Eina_Bool local)
+{
+   size_t size = WIDTH * HEIGHT * 4;
 
-   fd_handler = ecore_main_fd_handler_add(server->listenSock, ECORE_FD_READ,
-                                          _socket_activity, server, NULL, NULL);
-   EINA_SAFETY_ON_NULL_GOTO(fd_handler, err_handler);
-   fd_handler6 = ecore_main_fd_handler_add(server->listen6Sock, ECORE_FD_READ,
-                                          _socket_activity, server, NULL, NULL);
-   EINA_SAFETY_ON_NULL_GOTO(fd_handler6, err_handler6);
+   s->shm_fd = -1;
+   if (!local)
+     {
+        s->frame_buffer = _buffer_get();
+        return !!s->frame_buffer;
+     }
 
-   ecore_main_loop_begin();
-   r = 0;
+   s->shm_fd = memfd_create("multi-seat-vnc", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+   if (s->shm_fd == -1)
+     return EINA_FALSE;
+   /* The viewer can rely on the size it was told */
+   if (ftruncate(s->shm_fd, size) == -1 ||
+       fcntl(s->shm_fd, F_ADD_SEALS,
+             F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) == -1)
+     goto err;
+   s->frame_buffer = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                          s->shm_fd, 0);
+   if (s->frame_buffer == MAP_FAILED)
+     goto err;
+   return EINA_TRUE;
 
-   ecore_main_fd_handler_del(fd_handler6);
+ err:
+   close(s->shm_fd);
+   s->shm_fd = -1;
+   s->frame_buffer = NULL;
+   return EINA_FALSE;
+}
 
- err_handler6:
-   ecore_main_fd_handler_del(fd_handler);
- err_handler:
-   ecore_animator_del(animator);
- err_draw:
-   evas_free(evas);
+static void
+_seat_buffer_free(struct Seat *s)
+{
+   if (s->shm_fd == -1)
+     {
+        _buffer_put(s->frame_buffer);
+        return;
+     }
+   munmap(s->frame_buffer, WIDTH * HEIGHT * 4);
+   close(s->shm_fd);
+}
+
+static void
+_seat_unref(struct Seat *s)
+{
+   if (--s->refs)
+     return;
+   evas_free(s->evas);
+   _seat_buffer_free(s);
+   _buffer_put(s->encode_buffer);
+   free(s->tiles);
+   free(s);
+}
+
+static void
+_tile_batch_free(struct Tile_Batch *b)
+{
+   unsigned i;
+
+   for (i = 0; i < b->ntiles; i++)
+     if (b->tiles[i].data)
+       eina_binbuf_free(b->tiles[i].data);
+   free(b);
+}
+
+static void
+_update_free(struct Update *u)
+{
+   struct Tile_Batch *b;
+
+   EINA_LIST_FREE(u->batches, b)
+     _tile_batch_free(b);
+   if (u->copies)
+     eina_binbuf_free(u->copies);
+   if (u->damage)
+     eina_binbuf_free(u->damage);
+   if (u->pseudo)
+     eina_binbuf_free(u->pseudo);
+   if (u->stream.requested)
+     sraRgnDestroy(u->stream.requested);
+   if (u->stream.held)
+     sraRgnDestroy(u->stream.held);
+   if (u->stream.sent)
+     sraRgnDestroy(u->stream.sent);
+   free(u);
+}
+
+static void
+_update_send(struct Update *u)
+{
+   struct Seat *s = u->seat;
+   rfbClientRec *client = s->client;
+   struct Client_Data *cd;
+   struct Tile_Batch *b;
+   Eina_Binbuf *msg;
+   Eina_List *l;
+   unsigned i;
+
+   s->update = NULL;
+   if (!client)
+     goto end;
+
+   msg = eina_binbuf_new();
+   if (u->failed || !msg ||
+       !encode_update_header(msg, u->npseudo + u->ncopies + u->ndamage +
+                             u->ntiles) ||
+       !eina_binbuf_append_buffer(msg, u->pseudo) ||
+       !eina_binbuf_append_buffer(msg, u->copies) ||
+       (u->damage && !eina_binbuf_append_buffer(msg, u->damage)))
+     goto err;
+   EINA_LIST_FOREACH(u->batches, l, b)
+     for (i = 0; i < b->ntiles; i++)
+       if (!eina_binbuf_append_buffer(msg, b->tiles[i].data))
+         goto err;
+
+   /* Damage alone means nothing to a player */
+   if (s->record && !u->shm)
+     record_update(s->record, &u->format.out, u->keyframe, msg);
+   cd = client->clientData;
+   /* Shared updates only go once the previous one is out, the memfd is
+      attached to the first byte of this one */
+   if (u->pass_fd)
+     {
+        cd->out_fd = s->shm_fd;
+        cd->shm_sent = EINA_TRUE;
+     }
+   if (_client_queue(client, msg) < 0)
+     {
+        msg = NULL;
+        goto err;
+     }
+   metrics_add(&cd->metrics, METRIC_ENCODE_NSEC, u->encode_nsec);
+   if (!cd->out)
+     _seat_frame_sent(s);
+   goto end;
+
+ err:
+   if (msg)
+     eina_binbuf_free(msg);
+   rfbCloseClient(client);
+   _client_drop(client);
+ end:
+   _update_free(u);
+   /* Catches up with the messages that came meanwhile */
+   if (s->client)
+     _reader_add(s->client->clientData);
+   _seat_unref(s);
+}
+
+static void
+_update_job(void *data, Ecore_Thread *thread)
+{
+   struct Update_Job *job = data;
+   struct Update *u = job->update;
+   const struct Tile_Batch *b = job->batch;
+   const char *fb = u->seat->encode_buffer;
+   struct Cache_Key key;
+   struct timespec start, end;
+   const struct Tile *t;
+   Eina_Bool cached;
+   unsigned i;
+
+   /* Raw in the frame buffer format is a plain copy, hashing the tile
+      would cost as much */
+   cached = u->encoding != rfbEncodingRaw || !u->format.identity;
+   clock_gettime(CLOCK_MONOTONIC, &start);
+   for (i = job->first; i < b->ntiles; i += job->step)
+     {
+        t = &b->tiles[i];
+        /* Whoever encodes a tile first pays for it, every other client
+           with the same tile and format only copies the bytes */
+        if (cached)
+          {
+             cache_key_set(&key, cache_tile_hash(fb, WIDTH * 4, t->x, t->y,
+                                                 t->w, t->h),
+                           t->x, t->y, t->w, t->h, u->encoding, 0,
+                           &u->format.out);
+             if (cache_fetch(&key, t->data))
+               continue;
+          }
+        if (!encode_rect(t->data, u->encoding, &u->format, fb, WIDTH * 4,
+                         t->x, t->y, t->w, t->h))
+          {
+             job->failed = EINA_TRUE;
+             break;
+          }
+        if (cached)
+          cache_store(&key, eina_binbuf_string_get(t->data),
+                      eina_binbuf_length_get(t->data));
+     }
+   clock_gettime(CLOCK_MONOTONIC, &end);
+   job->nsec = (end.tv_sec - start.tv_sec) * 1000000000ull +
+      end.tv_nsec - start.tv_nsec;
+}
+
+/* Sent once every job and the submission itself are done. Jobs end in the
+   main loop, after the submission counted them all. */
+static void
+_update_done(struct Update *u)
+{
+   if (++u->done <= u->njobs)
+     return;
+   _update_send(u);
+}
+
+static void
+_update_job_end(void *data, Ecore_Thread *thread)
+{
+   struct Update_Job *job = data;
+   struct Update *u = job->update;
+
+   if (job->failed)
+     u->failed = EINA_TRUE;
+   u->encode_nsec += job->nsec;
+   free(job);
+   _update_done(u);
+}
+
+/* The job never ran, its tiles are empty and the update must not go */
+static void
+_update_job_cancel(void *data, Ecore_Thread *thread)
+{
+   struct Update_Job *job = data;
+
+   job->failed = EINA_TRUE;
+   _update_job_end(data, thread);
+}
+
+static unsigned
+_region_tiles_count(sraRegionPtr rgn)
+{
+   sraRectangleIterator *itr;
+   sraRect r;
+   unsigned count = 0;
+
+   itr = sraRgnGetIterator(rgn);
+   EINA_SAFETY_ON_NULL_RETURN_VAL(itr, 0);
+   while (sraRgnIteratorNext(itr, &r))
+     count += ((r.x2 - r.x1 + ENCODE_TILE - 1) / ENCODE_TILE) *
+        ((r.y2 - r.y1 + ENCODE_TILE - 1) / ENCODE_TILE);
+   sraRgnReleaseIterator(itr);
+   return count;
+}
+
+static void
+_region_rect_add(sraRegionPtr rgn, const Eina_Rectangle *r)
+{
+   sraRegionPtr add;
+
+   if (eina_rectangle_is_empty(r))
+     return;
+   add = sraRgnCreateRect(r->x, r->y, r->x + r->w, r->y + r->h);
+   sraRgnOr(rgn, add);
+   sraRgnDestroy(add);
+}
+
+/* Splits rgn in tiles and copies them where the threads read, the render
+   of the next frame may start as soon as this returns */
+static struct Tile_Batch *
+_update_tiles_add(struct Update *u, sraRegionPtr rgn)
+{
+   struct Seat *s = u->seat;
+   sraRectangleIterator *itr;
+   struct Tile_Batch *b;
+   struct Tile *t;
+   sraRect r;
+   int x, y;
+
+   if (!s->encode_buffer)
+     {
+        s->encode_buffer = _buffer_get();
+        EINA_SAFETY_ON_NULL_RETURN_VAL(s->encode_buffer, NULL);
+     }
+   b = calloc(1, sizeof(struct Tile_Batch) +
+              _region_tiles_count(rgn) * sizeof(struct Tile));
+   EINA_SAFETY_ON_NULL_RETURN_VAL(b, NULL);
+   itr = sraRgnGetIterator(rgn);
+   EINA_SAFETY_ON_NULL_GOTO(itr, err);
+   while (sraRgnIteratorNext(itr, &r))
+     for (y = r.y1; y < r.y2; y += ENCODE_TILE)
+       for (x = r.x1; x < r.x2; x += ENCODE_TILE)
+         {
+            t = &b->tiles[b->ntiles++];
+            t->x = x;
+            t->y = y;
+            t->w = r.x2 - x < ENCODE_TILE ? r.x2 - x : ENCODE_TILE;
+            t->h = r.y2 - y < ENCODE_TILE ? r.y2 - y : ENCODE_TILE;
+            t->data = eina_binbuf_new();
+            if (!t->data)
+              {
+                 sraRgnReleaseIterator(itr);
+                 goto err;
+              }
+            pixel_blit((uint32_t *)s->encode_buffer + y * WIDTH + x, WIDTH,
+                       (const uint32_t *)s->frame_buffer + y * WIDTH + x,
+                       WIDTH, t->w, t->h);
+         }
+   sraRgnReleaseIterator(itr);
+   u->batches = eina_list_append(u->batches, b);
+   u->ntiles += b->ntiles;
+   return b;
+
+ err:
+   _tile_batch_free(b);
+   return NULL;
+}
+
+/* The tiles are independent rectangles, so they scale with the cores */
+static void
+_update_jobs_run(struct Update *u, const struct Tile_Batch *b)
+{
+   struct Update_Job *job;
+   unsigned i, n;
+
+   n = ecore_thread_max_get();
+   if (n < 1)
+     n = 1;
+   if (n > b->ntiles)
+     n = b->ntiles;
+   for (i = 0; i < n; i++)
+     {
+        job = calloc(1, sizeof(struct Update_Job));
+        if (!job)
+          {
+             /* Its tiles stay empty, the update is dropped once done */
+             u->failed = EINA_TRUE;
+             continue;
+          }
+        job->update = u;
+        job->batch = b;
+        job->first = i;
+        job->step = n;
+        u->njobs++;
+        ecore_thread_run(_update_job, _update_job_end, _update_job_cancel,
+                         job);
+     }
+}
+
+/* Splits what the client asked for the same way rfbSendFramebufferUpdate()
+   does: the requested part of the copy region goes as CopyRect, the rest of
+   it is folded in the modified region, whose requested part is sent. */
+static Eina_Bool
+_update_regions_take(rfbClientRec *client, sraRegionPtr *copy,
+                     sraRegionPtr *modified)
+{
+   sraRegionPtr rgn;
+
+   *copy = sraRgnCreateRgn(client->copyRegion);
+   sraRgnAnd(*copy, client->requestedRegion);
+   rgn = sraRgnCreateRgn(client->requestedRegion);
+   sraRgnOffset(rgn, client->copyDX, client->copyDY);
+   sraRgnAnd(*copy, rgn);
+   sraRgnDestroy(rgn);
+
+   sraRgnSubtract(client->copyRegion, *copy);
+   sraRgnOr(client->modifiedRegion, client->copyRegion);
+   sraRgnMakeEmpty(client->copyRegion);
+
+   *modified = sraRgnCreateRgn(client->modifiedRegion);
+   sraRgnAnd(*modified, client->requestedRegion);
+
+   if (sraRgnEmpty(*copy) && sraRgnEmpty(*modified))
+     {
+        sraRgnDestroy(*copy);
+        sraRgnDestroy(*modified);
+        return EINA_FALSE;
+     }
+
+   sraRgnSubtract(client->modifiedRegion, *modified);
+   sraRgnMakeEmpty(client->requestedRegion);
+   return EINA_TRUE;
+}
+
+static Eina_Bool
+_update_copies_add(struct Update *u, rfbClientRec *client, sraRegionPtr rgn)
+{
+   sraRectangleIterator *itr;
+   sraRect r;
+   int dx = client->copyDX, dy = client->copyDY;
+
+   /* Ordered so no copy overwrites the source of a following one */
+   itr = sraRgnGetReverseIterator(rgn, dx > 0, dy > 0);
+   EINA_SAFETY_ON_NULL_RETURN_VAL(itr, EINA_FALSE);
+   while (sraRgnIteratorNext(itr, &r))
+     {
+        if (!encode_copy_rect(u->copies, r.x1, r.y1, r.x2 - r.x1, r.y2 - r.y1,
+                              r.x1 - dx, r.y1 - dy))
+          {
+             sraRgnReleaseIterator(itr);
+             return EINA_FALSE;
+          }
+        u->ncopies++;
+     }
+   sraRgnReleaseIterator(itr);
+   return EINA_TRUE;
+}
+
+static Eina_Bool
+_update_cursor_pending(const rfbClientRec *client)
+{
+   return (client->enableCursorShapeUpdates && client->cursorWasChanged) ||
+      (client->enableCursorPosUpdates && client->cursorWasMoved);
+}
+
+/* As rfbSendFramebufferUpdate() does: the shape once the viewer asked
+   for it, the position whenever the server moved the cursor */
+static Eina_Bool
+_update_cursor_add(struct Update *u, struct Seat *s, rfbClientRec *client)
+{
+   struct Encode_Cursor c = {
+      CURSOR_W, CURSOR_H, 0, 0, s->cursor.pixels
+   };
+   Eina_Bool r;
+
+   if (client->enableCursorShapeUpdates && client->cursorWasChanged)
+     {
+        if (client->useRichCursorEncoding)
+          r = encode_cursor_rich(u->pseudo, &u->format, &c);
+        else
+          r = encode_cursor_x(u->pseudo, &c, _seat_color(s), 0);
+        if (!r)
+          return EINA_FALSE;
+        client->cursorWasChanged = FALSE;
+        u->npseudo++;
+     }
+   if (client->enableCursorPosUpdates && client->cursorWasMoved)
+     {
+        if (!encode_cursor_pos(u->pseudo, s->screen->cursorX,
+                               s->screen->cursorY))
+          return EINA_FALSE;
+        client->cursorWasMoved = FALSE;
+        u->npseudo++;
+     }
+   return EINA_TRUE;
+}
+
+static struct Update *
+_update_new(struct Seat *s)
+{
+   rfbClientRec *client = s->client;
+   struct Update *u;
+
+   u = calloc(1, sizeof(struct Update));
+   EINA_SAFETY_ON_NULL_RETURN_VAL(u, NULL);
+   u->seat = s;
+   u->encoding = client->preferredEncoding;
+   encode_format_set(&u->format, &s->screen->serverFormat, &client->format);
+   u->copies = eina_binbuf_new();
+   EINA_SAFETY_ON_NULL_GOTO(u->copies, err);
+   u->pseudo = eina_binbuf_new();
+   EINA_SAFETY_ON_NULL_GOTO(u->pseudo, err);
+   if (_client_shm(client))
+     {
+        u->shm = EINA_TRUE;
+        u->damage = eina_binbuf_new();
+        EINA_SAFETY_ON_NULL_GOTO(u->damage, err);
+     }
+   return u;
+
+ err:
+   _update_free(u);
+   return NULL;
+}
+
+/* The pixels are already where the viewer reads, only where they changed
+   is sent. The first update also hands it the memfd. */
+static Eina_Bool
+_update_damage_add(struct Update *u, rfbClientRec *client, sraRegionPtr rgn)
+{
+   struct Client_Data *cd = client->clientData;
+   sraRectangleIterator *itr;
+   sraRect r;
+
+   if (!cd->shm_sent)
+     {
+        if (!encode_shm_fd(u->damage, WIDTH, HEIGHT))
+          return EINA_FALSE;
+        u->pass_fd = EINA_TRUE;
+        u->ndamage++;
+     }
+   itr = sraRgnGetIterator(rgn);
+   EINA_SAFETY_ON_NULL_RETURN_VAL(itr, EINA_FALSE);
+   while (sraRgnIteratorNext(itr, &r))
+     {
+        if (!encode_shm_damage(u->damage, r.x1, r.y1, r.x2 - r.x1,
+                               r.y2 - r.y1))
+          {
+             sraRgnReleaseIterator(itr);
+             return EINA_FALSE;
+          }
+        u->ndamage++;
+     }
+   sraRgnReleaseIterator(itr);
+   return EINA_TRUE;
+}
+
+/* Encodes the modified region tile by tile over the Ecore thread pool */
+static Eina_Bool
+_update_fill(struct Update *u, rfbClientRec *client, sraRegionPtr copy,
+             sraRegionPtr modified)
+{
+   struct Tile_Batch *b;
+
+   EINA_SAFETY_ON_FALSE_RETURN_VAL(_update_copies_add(u, client, copy),
+                                   EINA_FALSE);
+   EINA_SAFETY_ON_FALSE_RETURN_VAL(_update_cursor_add(u, u->seat, client),
+                                   EINA_FALSE);
+   if (u->shm)
+     return _update_damage_add(u, client, modified);
+   if (sraRgnEmpty(modified))
+     return EINA_TRUE;
+   b = _update_tiles_add(u, modified);
+   EINA_SAFETY_ON_NULL_RETURN_VAL(b, EINA_FALSE);
+   _update_jobs_run(u, b);
+   return EINA_TRUE;
+}
+
+/* Copies are sent as what they modified */
+static void
+_update_copies_fold(rfbClientRec *client)
+{
+   sraRgnOr(client->modifiedRegion, client->copyRegion);
+   sraRgnMakeEmpty(client->copyRegion);
+}
+
+/* The recording wants the whole screen: copies and everything already
+   modified are sent as pixels, along with the cursor */
+static void
+_update_keyframe_mark(rfbClientRec *client)
+{
+   sraRegionPtr all;
+
+   all = sraRgnCreateRect(0, 0, WIDTH, HEIGHT);
+   sraRgnOr(client->modifiedRegion, all);
+   sraRgnDestroy(all);
+   _update_copies_fold(client);
+   client->cursorWasChanged = TRUE;
+   client->cursorWasMoved = TRUE;
+}
+
+static Eina_Bool
+_update_keyframe_is(sraRegionPtr copy, sraRegionPtr modified)
+{
+   sraRegionPtr rest;
+   Eina_Bool all;
+
+   if (!sraRgnEmpty(copy))
+     return EINA_FALSE;
+   rest = sraRgnCreateRect(0, 0, WIDTH, HEIGHT);
+   sraRgnSubtract(rest, modified);
+   all = sraRgnEmpty(rest);
+   sraRgnDestroy(rest);
+   return all;
+}
+
+static void
+_update_start(struct Seat *s)
+{
+   rfbClientRec *client = s->client;
+   sraRegionPtr copy, modified;
+   struct Update *u;
+   Eina_Bool keyframe;
+
+   /* The shared frame buffer already has what the copy moved */
+   if (_client_shm(client))
+     _update_copies_fold(client);
+   keyframe = !_client_shm(client) && s->record &&
+      record_keyframe_due(s->record, &client->format);
+   if (keyframe)
+     _update_keyframe_mark(client);
+   if (!_update_regions_take(client, &copy, &modified))
+     {
+        if (!_update_cursor_pending(client))
+          return;
+        /* Only the cursor, it still answers the request */
+        copy = sraRgnCreate();
+        modified = sraRgnCreate();
+        sraRgnMakeEmpty(client->requestedRegion);
+     }
+
+   u = _update_new(s);
+   EINA_SAFETY_ON_NULL_GOTO(u, err_update);
+   /* A partial request leaves the rest for the next update */
+   u->keyframe = keyframe && _update_keyframe_is(copy, modified);
+   EINA_SAFETY_ON_FALSE_GOTO(_update_fill(u, client, copy, modified),
+                             err_fill);
+   sraRgnDestroy(copy);
+   sraRgnDestroy(modified);
+
+   s->refs++;
+   s->update = u;
+   _update_done(u);
+   return;
+
+ err_fill:
+   /* Jobs only start once everything else is in place */
+   _update_free(u);
+ err_update:
+   sraRgnDestroy(copy);
+   sraRgnDestroy(modified);
+   rfbCloseClient(client);
+   _client_drop(client);
+}
+
+/* When the client is waiting for a frame, its update is opened before the
+   canvas is rendered: each region Evas finishes is encoded right away,
+   while the next ones render. What can still change afterwards, the copy
+   destination and the cursor, waits for _update_stream_end(). */
+static void
+_update_stream_begin(struct Seat *s)
+{
+   rfbClientRec *client = s->client;
+   Eina_Rectangle r;
+   struct Update *u;
+   int dx, dy;
+
+   u = _update_new(s);
+   EINA_SAFETY_ON_NULL_RETURN(u);
+   u->stream.requested = sraRgnCreateRgn(client->requestedRegion);
+   u->stream.held = sraRgnCreate();
+   u->stream.sent = sraRgnCreate();
+   if (_move_translation_get(&s->move, &r, &dx, &dy))
+     _region_rect_add(u->stream.held, &r);
+   _region_rect_add(u->stream.held, &s->cursor.hidden);
+   EINA_RECTANGLE_SET(&r, s->pointer.x, s->pointer.y, CURSOR_W, CURSOR_H);
+   _region_rect_add(u->stream.held, &r);
+   u->stream.open = EINA_TRUE;
+
+   s->refs++;
+   s->update = u;
+}
+
+static void
+_update_stream_region(struct Update *u, int x, int y, int w, int h)
+{
+   struct Tile_Batch *b;
+   sraRegionPtr rgn;
+
+   rgn = sraRgnCreateRect(x, y, x + w, y + h);
+   sraRgnAnd(rgn, u->stream.requested);
+   sraRgnSubtract(rgn, u->stream.held);
+   /* Render updates may overlap, what already went is not sent twice */
+   sraRgnSubtract(rgn, u->stream.sent);
+   /* Without memory for it the region only waits for the end */
+   if (!sraRgnEmpty(rgn) && (b = _update_tiles_add(u, rgn)))
+     {
+        _update_jobs_run(u, b);
+        sraRgnOr(u->stream.sent, rgn);
+     }
+   sraRgnDestroy(rgn);
+}
+
+/* Once the render damage is marked, whatever was not streamed goes as
+   _update_start() would send it */
+static void
+_update_stream_end(struct Seat *s)
+{
+   rfbClientRec *client = s->client;
+   struct Update *u = s->update;
+   sraRegionPtr copy, modified;
+
+   u->stream.open = EINA_FALSE;
+   if (!_update_regions_take(client, &copy, &modified))
+     {
+        if (!u->ntiles && !_update_cursor_pending(client))
+          {
+             /* Nothing rendered, the request waits for a frame */
+             s->update = NULL;
+             _update_free(u);
+             _seat_unref(s);
+             return;
+          }
+        copy = sraRgnCreate();
+        modified = sraRgnCreate();
+        sraRgnMakeEmpty(client->requestedRegion);
+     }
+   sraRgnSubtract(modified, u->stream.sent);
+   if (!_update_fill(u, client, copy, modified))
+     u->failed = EINA_TRUE;
+   sraRgnDestroy(copy);
+   sraRgnDestroy(modified);
+   _update_done(u);
+}
+
+static void
+_seat_update(struct Seat *s)
+{
+   rfbClientRec *client = s->client;
+   struct Client_Data *cd;
+
+   if (_client_encodable(client))
+     {
+        _update_start(s);
+        return;
+     }
+
+   cd = client->clientData;
+   if (_client_capture(client) < 0)
+     {
+        if (client->sock != -1)
+          rfbCloseClient(client);
+        _client_drop(client);
+        return;
+     }
+   if (!cd->out)
+     _seat_frame_sent(s);
+}
+
+static sraRegionPtr
+_seat_damage_region(const struct Seat *s)
+{
+   Eina_Rectangle *update;
+   sraRegionPtr modified, rgn;
+   Eina_List *n;
+
+   modified = sraRgnCreate();
+   EINA_LIST_FOREACH(s->damage, n, update)
+     {
+        rgn = sraRgnCreateRect(update->x, update->y,
+                               update->x + update->w, update->y + update->h);
+        sraRgnOr(modified, rgn);
+        sraRgnDestroy(rgn);
+     }
+   return modified;
+}
+
+static uint64_t
+_seat_tile_hash(const struct Seat *s, int tx, int ty)
+{
+   int x = tx * DAMAGE_TILE, y = ty * DAMAGE_TILE;
+   int w = WIDTH - x < DAMAGE_TILE ? WIDTH - x : DAMAGE_TILE;
+   int h = HEIGHT - y < DAMAGE_TILE ? HEIGHT - y : DAMAGE_TILE;
+
+   return pixel_hash((const uint32_t *)s->frame_buffer + y * WIDTH + x,
+                     WIDTH, w, h);
+}
+
+static Eina_Bool
+_seat_tiles_init(struct Seat *s)
+{
+   int tx, ty;
+
+   s->tiles = malloc(DAMAGE_TILES_X * DAMAGE_TILES_Y * sizeof(uint64_t));
+   EINA_SAFETY_ON_NULL_RETURN_VAL(s->tiles, EINA_FALSE);
+   for (ty = 0; ty < DAMAGE_TILES_Y; ty++)
+     for (tx = 0; tx < DAMAGE_TILES_X; tx++)
+       s->tiles[ty * DAMAGE_TILES_X + tx] = _seat_tile_hash(s, tx, ty);
+   return EINA_TRUE;
+}
+
+/* Evas damages whole objects, whatever they look like now. Only the tiles
+   it touched can have changed, those whose hash did are modified and runs
+   of them in a row go as one rectangle. */
+static sraRegionPtr
+_seat_damage_tiles(struct Seat *s)
+{
+   unsigned char touched[DAMAGE_TILES_Y][DAMAGE_TILES_X];
+   Eina_Rectangle *update, frame, r;
+   sraRegionPtr modified, rgn;
+   int tx, ty, run, bottom;
+   Eina_Bool changed;
+   uint64_t hash;
+   Eina_List *n;
+
+   memset(touched, 0, sizeof(touched));
+   EINA_RECTANGLE_SET(&frame, 0, 0, WIDTH, HEIGHT);
+   EINA_LIST_FOREACH(s->damage, n, update)
+     {
+        r = *update;
+        if (!eina_rectangle_intersection(&r, &frame))
+          continue;
+        for (ty = r.y / DAMAGE_TILE; ty * DAMAGE_TILE < r.y + r.h; ty++)
+          for (tx = r.x / DAMAGE_TILE; tx * DAMAGE_TILE < r.x + r.w; tx++)
+            touched[ty][tx] = 1;
+     }
+
+   modified = sraRgnCreate();
+   for (ty = 0; ty < DAMAGE_TILES_Y; ty++)
+     {
+        bottom = (ty + 1) * DAMAGE_TILE;
+        if (bottom > HEIGHT)
+          bottom = HEIGHT;
+        /* One past the last tile closes the run still open */
+        for (tx = 0, run = -1; tx <= DAMAGE_TILES_X; tx++)
+          {
+             changed = EINA_FALSE;
+             if (tx < DAMAGE_TILES_X && touched[ty][tx])
+               {
+                  hash = _seat_tile_hash(s, tx, ty);
+                  changed = hash != s->tiles[ty * DAMAGE_TILES_X + tx];
+                  s->tiles[ty * DAMAGE_TILES_X + tx] = hash;
+               }
+             if (changed && run == -1)
+               run = tx;
+             else if (!changed && run != -1)
+               {
+                  rgn = sraRgnCreateRect(run * DAMAGE_TILE, ty * DAMAGE_TILE,
+                                         tx == DAMAGE_TILES_X ?
+                                         WIDTH : tx * DAMAGE_TILE, bottom);
+                  sraRgnOr(modified, rgn);
+                  sraRgnDestroy(rgn);
+                  run = -1;
+               }
+          }
+     }
+   return modified;
+}
+
+/* Hands the rendered damage over to libvncserver */
+static void
+_seat_mark(struct Seat *s)
+{
+   Eina_Rectangle copy;
+   sraRegionPtr modified, rgn;
+   int dx, dy;
+
+   /* An update still to be sent already carries older input */
+   if (!s->latency.frame)
+     s->latency.frame = s->latency.input;
+   s->latency.input = 0;
+
+   modified = s->tiles ? _seat_damage_tiles(s) : _seat_damage_region(s);
+   evas_render_updates_free(s->damage);
+   s->damage = NULL;
+
+   /* The copy goes first, marking the exposed area before it would make
+      libvncserver think the copy source is stale and send it anyway. */
+   if (_move_translation_get(&s->move, &copy, &dx, &dy))
+     {
+        rfbScheduleCopyRect(s->screen, copy.x, copy.y,
+                            copy.x + copy.w, copy.y + copy.h, dx, dy);
+        rgn = sraRgnCreateRect(copy.x, copy.y,
+                               copy.x + copy.w, copy.y + copy.h);
+        sraRgnSubtract(modified, rgn);
+        sraRgnDestroy(rgn);
+     }
+   if (s->move.obj)
+     _move_track(&s->move, s->move.obj);
+
+   if (!sraRgnEmpty(modified))
+     rfbMarkRegionAsModified(s->screen, modified);
+   sraRgnDestroy(modified);
+}
+
+/* Render, encode and send are stages of a pipeline: while the update of
+   frame N is encoded by the threads or drained by the socket, frame N+1 is
+   rendered and marked, then waits for the client to ask for it. */
+static Eina_Bool
+_seat_in_flight(const struct Seat *s)
+{
+   struct Client_Data *cd = s->client->clientData;
+
+   return s->update || cd->out;
+}
+
+static void
+_seat_push(struct Seat *s)
+{
+   struct Client_Data *cd = s->client->clientData;
+
+   _seat_mark(s);
+   metrics_add(&cd->metrics, METRIC_FRAMES, 1);
+   if (s->update && s->update->stream.open)
+     _update_stream_end(s);
+   else if (_seat_in_flight(s))
+     s->ahead = EINA_TRUE;
+   else if (_client_send_ready(s->client))
+     _seat_update(s);
+   else
+     /* Merged in whatever frame the client can take next */
+     metrics_add(&cd->metrics, METRIC_FRAMES_DROPPED, 1);
+}
+
+/* Tile hashes need the whole frame rendered to tell what changed */
+static Eina_Bool
+_seat_can_stream(const struct Seat *s)
+{
+   /* Keyframes go whole through _update_start() */
+   if (s->record && record_keyframe_due(s->record, &s->client->format))
+     return EINA_FALSE;
+   /* Nothing to encode while it renders */
+   if (_client_shm(s->client))
+     return EINA_FALSE;
+   return !s->tiles && !_seat_in_flight(s) && _client_encodable(s->client) &&
+      _client_send_ready(s->client);
+}
+
+/* A seat is rendered when its client asked for an update and can take it,
+   or one frame ahead while its previous update is in flight. The frames
+   after that keep their damage in the canvas: the queue between the
+   stages is one frame deep. */
+static Eina_Bool
+_seat_wants_frame(const struct Seat *s)
+{
+   rfbClientRec *client = s->client;
+
+   if (!client)
+     return EINA_FALSE;
+   /* The rectangle never stops, but the frame buffer of a shared seat is
+      read by its viewer until it asks for the next update */
+   if (_seat_in_flight(s))
+     return !s->ahead && s->rect && !_client_shm(client);
+   if (sraRgnEmpty(client->requestedRegion))
+     return EINA_FALSE;
+   return s->ahead || s->rect || FB_UPDATE_PENDING(client);
+}
+
+/* The animator only runs while some seat wants a frame or has pointer
+   motions to flush, with no client or only idle ones nothing is rendered
+   at all. */
+static Eina_Bool
+_anim(void *data)
+{
+   Eina_List *l, *l_next;
+   struct Seat *s;
+   Eina_Bool damaged;
+
+   EINA_LIST_FOREACH_SAFE(seats, l, l_next, s)
+     {
+        _seat_pointer_flush(s);
+        if (!_seat_wants_frame(s))
+          continue;
+        /* Already rendered, it only waited for the request */
+        if (s->ahead)
+          {
+             if (!_client_send_ready(s->client))
+               continue;
+             s->ahead = EINA_FALSE;
+             _seat_update(s);
+             continue;
+          }
+        _seat_animate(s);
+        _seat_cursor_hide(s);
+        if (_seat_can_stream(s))
+          _update_stream_begin(s);
+        damaged = _seat_render(s);
+        if (_seat_cursor_show(s))
+          damaged = EINA_TRUE;
+        if (damaged || FB_UPDATE_PENDING(s->client))
+          _seat_push(s);
+        else if (s->update && s->update->stream.open)
+          _update_stream_end(s);
+     }
+
+   /* Those still waiting are congested, check them again next tick */
+   EINA_LIST_FOREACH(seats, l, s)
+     if (_seat_wants_frame(s))
+       return ECORE_CALLBACK_RENEW;
+
+   animator = NULL;
+   return ECORE_CALLBACK_CANCEL;
+}
+
+static void
+_seat_schedule(struct Seat *s)
+{
+   if (animator || (!_seat_wants_frame(s) && !s->pointer.pending))
+     return;
+   animator = ecore_animator_add(_anim, NULL);
+   EINA_SAFETY_ON_NULL_RETURN(animator);
+}
+
+static int
+_draw_objects(struct Seat *s)
+{
+   Evas_Object *bg, *txt, *rect;
+   Evas *evas = s->evas;
+
+   bg = evas_object_rectangle_add(evas);
+   EINA_SAFETY_ON_NULL_RETURN_VAL(bg, -1);
+   evas_object_color_set(bg, 255, 255, 255, 255);
+   evas_object_move(bg, 0, 0);
+   evas_object_resize(bg, WIDTH, HEIGHT);
+   evas_object_show(bg);
+
+   txt = evas_object_text_add(evas);
+   EINA_SAFETY_ON_NULL_RETURN_VAL(txt, -1);
+   evas_object_color_set(txt, 0, 0, 0, 255);
+   evas_object_text_style_set(txt, EVAS_TEXT_STYLE_PLAIN);
+   evas_object_text_font_set(txt, "Sans", 15);
+   evas_object_text_text_set(txt,
+      "Move your mouse and press your keyboard keys. Press ESC to exit. ");
+   evas_object_move(txt, 0, 0);
+   evas_object_show(txt);
+
+   rect = evas_object_rectangle_add(evas);
+   EINA_SAFETY_ON_NULL_RETURN_VAL(rect, -1);
+   evas_object_color_set(rect, 255, 0, 0, 255);
+   evas_object_resize(rect, RECT_DIMEN, RECT_DIMEN);
+   evas_object_move(rect, (WIDTH - RECT_DIMEN) /2, (HEIGHT- RECT_DIMEN)/2);
+   evas_object_show(rect);
+   s->rect = rect;
+   s->direction = LEFT;
+   s->anim_time = ecore_loop_time_get();
+   _move_track(&s->move, rect);
+
+   return 0;
+}
+
+/* The canvas and frame buffer outlive the seat while an update of it is
+   still being encoded */
+static void
+_seat_free(struct Seat *s)
+{
+   seats = eina_list_remove(seats, s);
+   /* Drops a client still attached, going through _client_gone() */
+   rfbScreenCleanup(s->screen);
+   evas_render_updates_free(s->damage);
+   s->damage = NULL;
+   _seat_unref(s);
+}
+
+static struct Seat *
+_seat_new(Eina_Bool local)
+{
+   struct Seat *s;
+
+   s = calloc(1, sizeof(struct Seat));
+   EINA_SAFETY_ON_NULL_RETURN_VAL(s, NULL);
+   s->refs = 1;
+
+   /* A screen per seat, it never listens: clients are handed to it
+      by _client_accept() */
+   s->screen = rfbGetScreen(NULL, NULL, WIDTH, HEIGHT, 8, 3, 4);
+   EINA_SAFETY_ON_NULL_GOTO(s->screen, err_screen);
+   s->screen->screenData = s;
+   s->screen->newClientHook = _new_client;
+   s->screen->kbdAddEvent = _keyboard_event;
+   s->screen->ptrAddEvent = _pointer_event;
+   s->screen->alwaysShared = TRUE;
+
+   EINA_SAFETY_ON_FALSE_GOTO(_seat_buffer_new(s, local), err_buffer);
+   s->screen->frameBuffer = s->frame_buffer;
+
+   s->evas = _create_evas_frame();
+   EINA_SAFETY_ON_NULL_GOTO(s->evas, err_evas);
+
+   EINA_SAFETY_ON_TRUE_GOTO(_draw_objects(s) == -1, err_draw);
+   rendering = s;
+   evas_render_updates_free(evas_render_updates(s->evas));
+   rendering = NULL;
+   if (damage_tiles)
+     EINA_SAFETY_ON_FALSE_GOTO(_seat_tiles_init(s), err_draw);
+
+   seats = eina_list_append(seats, s);
+   return s;
+
+ err_draw:
+   evas_free(s->evas);
  err_evas:
-   free(server->frameBuffer);
+   _seat_buffer_free(s);
  err_buffer:
+   rfbScreenCleanup(s->screen);
+ err_screen:
+   free(s);
+   return NULL;
+}
+
+static void
+_sig_action(int signum)
+{
+   ecore_main_loop_quit();
+}
+
+/* SIGUSR1 dumps the metrics, stdout is busy with the input events */
+static Eina_Bool
+_sig_user(void *data, int type, void *event)
+{
+   Ecore_Event_Signal_User *ev = event;
+
+   if (ev->number == 1)
+     metrics_dump(stderr);
+   return ECORE_CALLBACK_PASS_ON;
+}
+
+static void
+_client_accept(int sock, Eina_Bool local)
+{
+   struct Seat *s;
+   int one = 1;
+
+   if (!local)
+     setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+   s = _seat_new(local);
+   if (!s)
+     {
+        close(sock);
+        return;
+     }
+
+   /* Refused clients are closed by libvncserver */
+   if (!rfbNewClient(s->screen, sock))
+     _seat_free(s);
+}
+
+/* Same as rfbProcessNewConnection(), but every connection gets its own
+   seat screen instead of joining the listening one */
+static void
+_listen_drain(struct Io *io)
+{
+   int sock;
+
+   for (;;)
+     {
+        sock = accept4(io->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (sock == -1)
+          {
+             if (errno == EINTR)
+               continue;
+             return;
+          }
+        _client_accept(sock, io->type == IO_LISTEN_LOCAL);
+     }
+}
+
+static int
+_listen_local(const char *path)
+{
+   struct sockaddr_un addr = { .sun_family = AF_UNIX };
+   int fd;
+
+   if (strlen(path) >= sizeof(addr.sun_path))
+     {
+        fprintf(stderr, "Socket path too long: %s\n", path);
+        return -1;
+     }
+   strcpy(addr.sun_path, path);
+   fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+   if (fd == -1)
+     goto err;
+   /* Left by an earlier run */
+   unlink(path);
+   if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+       listen(fd, SOMAXCONN) == -1)
+     {
+        close(fd);
+        goto err;
+     }
+   return fd;
+
+ err:
+   perror(path);
+   return -1;
+}
+
+static Eina_Bool
+_io_listen_add(struct Io *io, int type, int fd)
+{
+   struct epoll_event ev;
+
+   io->type = type;
+   io->fd = fd;
+   if (fd == -1)
+     return EINA_TRUE;
+
+   if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) == -1)
+     return EINA_FALSE;
+   ev.events = EPOLLIN | EPOLLET;
+   /* Served a bit per wake up, it stays ready until done */
+   if (type == IO_METRICS)
+     ev.events = EPOLLIN;
+   ev.data.ptr = io;
+   return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == 0;
+}
+
+/* The main loop only watches the epoll set, edges are drained completely
+   so no socket has to be looked at again until it gets new data. The
+   metrics set is the exception, it is level triggered. */
+static Eina_Bool
+_io_activity(void *data, Ecore_Fd_Handler *fd_handler)
+{
+   struct epoll_event ev[IO_EVENTS];
+   struct Client_Data *cd;
+   struct Io *io;
+   int i, n;
+
+   n = epoll_wait(epoll_fd, ev, IO_EVENTS, 0);
+   for (i = 0; i < n; i++)
+     {
+        io = ev[i].data.ptr;
+        if (io->type == IO_LISTEN || io->type == IO_LISTEN_LOCAL)
+          _listen_drain(io);
+        else if (io->type == IO_METRICS)
+          metrics_serve();
+        else
+          _client_io((struct Client_Data *)io, ev[i].events);
+     }
+
+   /* Their ids are only free once no event can point to them */
+   EINA_LIST_FREE(clients_gone, cd)
+     seat_table_del(clients, cd->id);
+   return ECORE_CALLBACK_RENEW;
+}
+
+int
+main(int argc, char *argv[])
+{
+   int r = -1, opt, local_fd = -1;
+   static struct Io listen_io, listen6_io, local_io, metrics_io;
+   const char *local_path = NULL;
+   Ecore_Fd_Handler *io_handler;
+   Ecore_Event_Handler *sig_handler;
+   struct Client_Data *cd;
+   struct sigaction sa;
+
+   sa.sa_handler = _sig_action;
+   sigemptyset(&sa.sa_mask);
+   sa.sa_flags = SA_RESETHAND;
+   sigaction(SIGINT, &sa, NULL);
+
+   EINA_SAFETY_ON_TRUE_RETURN_VAL(evas_init() == 0, -1);
+   EINA_SAFETY_ON_FALSE_GOTO(cache_init(CACHE_SIZE), err_cache);
+   EINA_SAFETY_ON_FALSE_GOTO(event_log_init(_event_print), err_log);
+   EINA_SAFETY_ON_TRUE_GOTO(ecore_init() == 0, err_ecore);
+   pixel_init();
+   metrics_init("multi-seat-vnc",
+                METRIC_MASK(METRIC_EVENTS) | METRIC_MASK(METRIC_BYTES_SENT) |
+                METRIC_MASK(METRIC_FRAMES) |
+                METRIC_MASK(METRIC_FRAMES_DROPPED) |
+                METRIC_MASK(METRIC_ENCODE_NSEC) |
+                METRIC_MASK(METRIC_QUEUED_BYTES) |
+                METRIC_MASK(METRIC_INPUT_THROTTLED));
+   clients = seat_table_new(sizeof(struct Client_Data), SEATS_MAX);
+   EINA_SAFETY_ON_NULL_GOTO(clients, err_clients);
+
+   /* Only used to listen, each seat has its own screen */
+   server = rfbGetScreen(&argc, argv, WIDTH, HEIGHT, 8, 3, 4);
+   EINA_SAFETY_ON_NULL_GOTO(server, err_server);
+
+   /* What libvncserver did not take */
+   while ((opt = getopt(argc, argv, "tr:R:L:")) != -1)
+     {
+        switch (opt)
+          {
+           case 't':
+              damage_tiles = EINA_TRUE;
+              break;
+           case 'r':
+              if (!event_log_trace_start(optarg, EVENT_TRACE_VNC))
+                goto err_opt;
+              break;
+           case 'R':
+              if (!record_init(optarg, RECORD_QUEUE))
+                goto err_opt;
+              break;
+           case 'L':
+              if (local_fd != -1)
+                {
+                   close(local_fd);
+                   unlink(local_path);
+                }
+              local_path = optarg;
+              local_fd = _listen_local(local_path);
+              if (local_fd == -1)
+                goto err_opt;
+              break;
+           default:
+              fprintf(stderr, "Usage: %s [-t] [-r trace] [-R dir] [-L path] "
+                      "[libvncserver options]\n"
+                      "  -t        only send the tiles whose pixels changed\n"
+                      "  -r trace  record the input of every seat to trace\n"
+                      "  -R dir    record what every seat is sent to dir\n"
+                      "  -L path   also listen on a Unix socket, viewers "
+                      "there can map their\n"
+                      "            seat frame buffer, see vnc-shm.h\n",
+                      argv[0]);
+              goto err_opt;
+          }
+     }
+   if (local_fd != -1)
+     rfbRegisterProtocolExtension(&shm_extension);
+
+   rfbInitServer(server);
+
+   epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+   EINA_SAFETY_ON_TRUE_GOTO(epoll_fd == -1, err_epoll);
+   EINA_SAFETY_ON_FALSE_GOTO(_io_listen_add(&listen_io, IO_LISTEN,
+                                            server->listenSock),
+                             err_handler);
+   EINA_SAFETY_ON_FALSE_GOTO(_io_listen_add(&listen6_io, IO_LISTEN,
+                                            server->listen6Sock),
+                             err_handler);
+   EINA_SAFETY_ON_FALSE_GOTO(_io_listen_add(&local_io, IO_LISTEN_LOCAL,
+                                            local_fd),
+                             err_handler);
+   EINA_SAFETY_ON_FALSE_GOTO(_io_listen_add(&metrics_io, IO_METRICS,
+                                            metrics_fd()),
+                             err_handler);
+   sig_handler = ecore_event_handler_add(ECORE_EVENT_SIGNAL_USER,
+                                         _sig_user, NULL);
+   EINA_SAFETY_ON_NULL_GOTO(sig_handler, err_handler);
+   io_handler = ecore_main_fd_handler_add(epoll_fd, ECORE_FD_READ,
+                                          _io_activity, NULL, NULL, NULL);
+   EINA_SAFETY_ON_NULL_GOTO(io_handler, err_handler);
+
+   ecore_main_loop_begin();
+   r = 0;
+
+   ecore_main_fd_handler_del(io_handler);
+   ecore_event_handler_del(sig_handler);
+
+ err_handler:
+   while (seats)
+     _seat_free(eina_list_data_get(seats));
+   EINA_LIST_FREE(clients_gone, cd)
+     seat_table_del(clients, cd->id);
+   if (latency_all.count)
+     latency_hist_print(&latency_all, stdout, "All seats input to update");
+   if (animator)
+     ecore_animator_del(animator);
+   if (readers_job)
+     ecore_job_del(readers_job);
+   close(epoll_fd);
+   if (capture_fd != -1)
+     close(capture_fd);
+ err_epoll:
+ err_opt:
+   if (local_fd != -1)
+     {
+        close(local_fd);
+        unlink(local_path);
+     }
+   record_shutdown();
    rfbScreenCleanup(server);
  err_server:
+   seat_table_free(clients);
+ err_clients:
+   metrics_shutdown();
+   /* Joins the encoding threads still running */
    ecore_shutdown();
+   _buffers_spare_free();
  err_ecore:
+   event_log_shutdown();
+ err_log:
+   cache_shutdown();
+ err_cache:
    evas_shutdown();
    return r;
 }
@@ -11,10 +11,20 @@
 #include <unistd.h>
 #include <signal.h>
 #include <poll.h>
+#include <sys/mman.h>
+#include <time.h>
 #include <wayland-client.h>
 
-#define SEAT_INTERFACE_VERSION (4)
-#define COMPOSITOR_INTERFACE_VERSION (1)
+#include "event-log.h"
+#include "latency-hist.h"
+#include "metrics.h"
+#include "pixel.h"
+#include "seat-table.h"
+
+/* wl_pointer.frame needs version 5 */
+#define SEAT_INTERFACE_VERSION (5)
+/* wl_surface.damage_buffer needs version 4 */
+#define COMPOSITOR_INTERFACE_VERSION (4)
 #define SHELL_INTERFACE_VERSION (1)
 #define SHM_INTERFACE_VERSION (1)
 
@@ -22,30 +32,278 @@
 #define WIDTH (800)
 #define STRIDE ((WIDTH) * (4))
 #define BUFFER_SIZE ((STRIDE) * (HEIGHT))
+/* A third buffer is only added when the compositor holds the other two */
+#define BUFFERS_MIN (2)
+#define BUFFERS_MAX (3)
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+/* Damage rectangles kept before they are merged in their bounds */
+#define DAMAGE_MAX (16)
+/* Seats bound at once */
+#define SEATS_MAX (65536)
+
+/* Each seat draws its pointer where it is and a status row at the top:
+   a swatch of its colour, its 3 buttons and its last keys */
+#define BOX (8)
+#define ROW_HEIGHT (12)
+#define KEYS_MAX (8)
+#define ROW_BUTTONS_X (16)
+#define ROW_KEYS_X (56)
+#define ROW_WIDTH ((ROW_KEYS_X) + (KEYS_MAX) * (ROW_HEIGHT))
+#define BACKGROUND (0x202020)
+#define RELEASED (0x404040)
+
+/* Compositor timestamps further than this from the local clock come from
+   another clock, they are not used */
+#define CLOCK_SKEW_MS (10 * 1000)
 
 /* It uses button numbers from linux/input.h */
 # define BTN_LEFT 0x110
 # define BTN_RIGHT 0x111
 # define BTN_MIDDLE 0x112
 
+struct Context;
+
 struct SeatItem {
+   struct Context *ctx;
    struct wl_seat *seat;
    struct wl_pointer *pointer;
    struct wl_keyboard *keyboard;
    char *name;
+   Event_Ring *events;
+   /* Motion not logged yet, only the last one of a frame is */
+   struct {
+      bool pending;
+      uint32_t time;
+      int x, y;
+   } motion;
+   /* What is drawn for the seat */
+   struct {
+      /* Status row, -1 without one */
+      int slot;
+      bool inside;
+      int x, y;
+      /* Bit per button, from 1 */
+      uint32_t buttons;
+      uint32_t keys[KEYS_MAX];
+      unsigned nkeys;
+   } view;
+   struct {
+      /* When the oldest input not drawn yet was sent, 0 if none */
+      double input;
+      /* The same for the input in the frame committed, until flushed */
+      double frame;
+      /* From the compositor sending an input to it being dispatched */
+      Latency_Hist delivery;
+      /* From the compositor sending an input to the frame showing it
+         being flushed */
+      Latency_Hist drawn;
+   } latency;
+   Metrics metrics;
+   /* The registry name */
    uint32_t id;
+   /* Of the record in the seat table */
+   unsigned table_id;
+   uint32_t version;
    uint32_t cap;
    struct wl_list link;
 };
 
+struct Damage {
+   Eina_Rectangle rects[DAMAGE_MAX];
+   unsigned n;
+};
+
+struct Buffer {
+   struct wl_buffer *buffer;
+   /* Attached and not released by the compositor yet */
+   bool busy;
+   /* What changed since it was last drawn */
+   struct Damage damage;
+};
+
+/* One memfd shared with the compositor for the whole run, buffers are
+   slices of it recycled once released */
+struct Pool {
+   struct wl_shm_pool *pool;
+   int fd;
+   char *data;
+   size_t size;
+   bool huge;
+   struct Buffer buffers[BUFFERS_MAX];
+   unsigned nbuffers;
+};
+
 struct Context {
    struct wl_compositor *compositor;
-   struct wl_buffer *buffer;
+   uint32_t compositor_version;
+   struct Pool pool;
    struct wl_shell *shell;
    struct wl_list seats;
+   /* Where the seat records live and the seats by registry name, which
+      the compositor picks anywhere in 32 bits so it cannot be an id */
+   Seat_Table *seat_table;
+   Eina_Hash *seat_ids;
    struct wl_shm *shm;
+   struct wl_surface *surface;
+   /* Pending frame callback, nothing is drawn until it is done */
+   struct wl_callback *frame;
+   /* What changed since the last commit */
+   struct Damage damage;
+   /* Status rows taken, a bit each so 32 at most */
+   uint32_t rows;
+};
+
+static const uint32_t _seat_colors[] = {
+   0xe04040, 0x40e040, 0x4080ff, 0xe0e040,
+   0xe040e0, 0x40e0e0, 0xff9020, 0xf0f0f0
 };
 
+static void
+_damage_add(struct Damage *d, const Eina_Rectangle *r)
+{
+   const Eina_Rectangle *c;
+   unsigned i;
+
+   for (i = 0; i < d->n; i++)
+     {
+        c = &d->rects[i];
+        /* Already covered, a seat changing twice in a frame does this */
+        if (r->x >= c->x && r->y >= c->y &&
+            r->x + r->w <= c->x + c->w && r->y + r->h <= c->y + c->h)
+          return;
+     }
+   if (d->n < DAMAGE_MAX)
+     {
+        d->rects[d->n++] = *r;
+        return;
+     }
+   for (i = 1; i < d->n; i++)
+     eina_rectangle_union(&d->rects[0], &d->rects[i]);
+   eina_rectangle_union(&d->rects[0], r);
+   d->n = 1;
+}
+
+/* Damages the next commit and every buffer, each one is brought up to
+   date when it is drawn again */
+static void
+_surface_damage(struct Context *ctx, int x, int y, int w, int h)
+{
+   Eina_Rectangle r, surface;
+   unsigned i;
+
+   EINA_RECTANGLE_SET(&r, x, y, w, h);
+   EINA_RECTANGLE_SET(&surface, 0, 0, WIDTH, HEIGHT);
+   if (!eina_rectangle_intersection(&r, &surface))
+     return;
+   _damage_add(&ctx->damage, &r);
+   for (i = 0; i < ctx->pool.nbuffers; i++)
+     _damage_add(&ctx->pool.buffers[i].damage, &r);
+}
+
+static void
+_seat_row_damage(struct SeatItem *item)
+{
+   if (item->view.slot < 0)
+     return;
+   _surface_damage(item->ctx, 0, item->view.slot * ROW_HEIGHT,
+                   ROW_WIDTH, ROW_HEIGHT);
+}
+
+static void
+_seat_pointer_damage(struct SeatItem *item)
+{
+   if (!item->view.inside)
+     return;
+   _surface_damage(item->ctx, item->view.x - BOX / 2, item->view.y - BOX / 2,
+                   BOX, BOX);
+}
+
+static void
+_seat_pointer_move(struct SeatItem *item, bool inside, int x, int y)
+{
+   if (item->view.inside == inside && item->view.x == x &&
+       item->view.y == y)
+     return;
+   _seat_pointer_damage(item);
+   item->view.inside = inside;
+   item->view.x = x;
+   item->view.y = y;
+   _seat_pointer_damage(item);
+}
+
+static double
+_now(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Compositors stamp input in milliseconds of CLOCK_MONOTONIC, so the
+   stamp tells when the event left the compositor. Without a usable stamp
+   the input counts from its arrival. */
+static void
+_input_stamp(struct SeatItem *item, uint32_t time)
+{
+   double now = _now();
+   int32_t delay;
+
+   delay = (uint32_t)(uint64_t)(now * 1000) - time;
+   /* A millisecond early is rounding */
+   if (delay >= -1 && delay <= CLOCK_SKEW_MS)
+     {
+        if (delay < 0)
+          delay = 0;
+        latency_hist_record(&item->latency.delivery, delay / 1000.);
+        now -= delay / 1000.;
+     }
+   if (!item->latency.input)
+     item->latency.input = now;
+}
+
+/* The frame just committed shows every input dispatched so far */
+static void
+_seats_rendered(struct Context *ctx)
+{
+   struct SeatItem *item;
+
+   wl_list_for_each(item, &ctx->seats, link)
+     {
+        if (!item->latency.frame)
+          item->latency.frame = item->latency.input;
+        item->latency.input = 0;
+     }
+}
+
+static void
+_seats_flushed(struct Context *ctx)
+{
+   struct SeatItem *item;
+   double now = 0;
+
+   wl_list_for_each(item, &ctx->seats, link)
+     {
+        if (!item->latency.frame)
+          continue;
+        if (!now)
+          now = _now();
+        latency_hist_record(&item->latency.drawn,
+                            now - item->latency.frame);
+        item->latency.frame = 0;
+     }
+}
+
+static void
+_pointer_motion_flush(struct SeatItem *item)
+{
+   if (!item->motion.pending)
+     return;
+   event_log_push(item->events, EVENT_POINTER_MOTION, item->motion.time,
+                  item->motion.x, item->motion.y);
+   item->motion.pending = false;
+}
+
 static void
 _pointer_moved(void *data,
                struct wl_pointer *wl_pointer,
@@ -55,8 +313,17 @@ _pointer_moved(void *data,
 {
    struct SeatItem *item = data;
 
-   printf("The pointer from seat '%s' has moved to X:%d Y:%d\n", item->name,
-          wl_fixed_to_int(surface_x), wl_fixed_to_int(surface_y));
+   _input_stamp(item, time);
+   metrics_add(&item->metrics, METRIC_EVENTS, 1);
+   item->motion.pending = true;
+   item->motion.time = time;
+   item->motion.x = wl_fixed_to_int(surface_x);
+   item->motion.y = wl_fixed_to_int(surface_y);
+   _seat_pointer_move(item, item->view.inside,
+                      item->motion.x, item->motion.y);
+   /* Older seats never send frames */
+   if (item->version < WL_POINTER_FRAME_SINCE_VERSION)
+     _pointer_motion_flush(item);
 }
 
 static void
@@ -67,6 +334,8 @@ _pointer_enter(void *data,
                wl_fixed_t surface_x,
                wl_fixed_t surface_y)
 {
+   _seat_pointer_move(data, true, wl_fixed_to_int(surface_x),
+                      wl_fixed_to_int(surface_y));
 }
 
 static void
@@ -75,6 +344,9 @@ _pointer_leave(void *data,
                uint32_t serial,
                struct wl_surface *surface)
 {
+   struct SeatItem *item = data;
+
+   _seat_pointer_move(item, false, item->view.x, item->view.y);
 }
 
 static void
@@ -87,6 +359,8 @@ _pointer_button(void *data,
 {
    struct SeatItem *item = data;
 
+   _input_stamp(item, time);
+   metrics_add(&item->metrics, METRIC_EVENTS, 1);
    /* Convert from linux to efl buttons */
    if (button == BTN_LEFT)
        button = 1;
@@ -95,12 +369,18 @@ _pointer_button(void *data,
    else if (button == BTN_RIGHT)
        button = 3;
 
-   if (state)
-       printf("The pointer from seat '%s' pressed the button '%"PRIu32"'\n",
-              item->name, button);
-   else
-       printf("The pointer from seat '%s' released the button '%"PRIu32"'\n",
-              item->name, button);
+   if (button >= 1 && button <= 3)
+     {
+        if (state == WL_POINTER_BUTTON_STATE_PRESSED)
+          item->view.buttons |= 1 << button;
+        else
+          item->view.buttons &= ~(1 << button);
+        _seat_row_damage(item);
+     }
+
+   /* Where the button changed is logged first */
+   _pointer_motion_flush(item);
+   event_log_push(item->events, EVENT_POINTER_BUTTON, time, button, state);
 }
 
 static void
@@ -116,6 +396,7 @@ static void
 _pointer_frame(void *data,
                struct wl_pointer *wl_pointer)
 {
+   _pointer_motion_flush(data);
 }
 
 static void
@@ -163,8 +444,15 @@ _keyboard_key_pressed(void *data,
 {
    struct SeatItem *item = data;
 
-   printf("Keyboard from seat '%s' pressed the key '%"PRIu32"'\n", item->name,
-          key);
+   _input_stamp(item, time);
+   metrics_add(&item->metrics, METRIC_EVENTS, 1);
+   event_log_push(item->events, EVENT_KEY, time, key, state);
+
+   if (state == WL_KEYBOARD_KEY_STATE_PRESSED)
+     {
+        item->view.keys[item->view.nkeys++ % KEYS_MAX] = key;
+        _seat_row_damage(item);
+     }
 }
 
 static void
@@ -221,18 +509,82 @@ static const struct wl_keyboard_listener _keyboard_listener = {
   .repeat_info = _keyboard_repeat_info
 };
 
+/* Runs on the logging thread */
+static void
+_event_print(const char *seat, const struct Event_Record *ev)
+{
+   switch (ev->type)
+     {
+      case EVENT_POINTER_MOTION:
+         printf("The pointer from seat '%s' has moved to X:%d Y:%d\n", seat,
+                ev->a, ev->b);
+         break;
+      case EVENT_POINTER_BUTTON:
+         printf("The pointer from seat '%s' %s the button '%"PRIu32"'\n",
+                seat, ev->b ? "pressed" : "released", (uint32_t)ev->a);
+         break;
+      case EVENT_KEY:
+         printf("Keyboard from seat '%s' %s the key '%"PRIu32"'\n", seat,
+                ev->b ? "pressed" : "released", (uint32_t)ev->a);
+         break;
+     }
+}
+
+static void
+_seat_latency_print(struct SeatItem *item)
+{
+   char label[128];
+
+   snprintf(label, sizeof(label), "Seat '%s' input delivery", item->name);
+   latency_hist_print(&item->latency.delivery, stdout, label);
+   snprintf(label, sizeof(label), "Seat '%s' input to frame", item->name);
+   latency_hist_print(&item->latency.drawn, stdout, label);
+}
+
+/* Seats past the last row still draw their pointer */
+static void
+_seat_row_take(struct SeatItem *item)
+{
+   struct Context *ctx = item->ctx;
+
+   if (ctx->rows == UINT32_MAX)
+     return;
+   item->view.slot = __builtin_ctz(~ctx->rows);
+   ctx->rows |= 1u << item->view.slot;
+   _seat_row_damage(item);
+}
+
+static void
+_seat_view_clear(struct SeatItem *item)
+{
+   _seat_pointer_damage(item);
+   _seat_row_damage(item);
+   if (item->view.slot >= 0)
+     item->ctx->rows &= ~(1u << item->view.slot);
+}
+
 static void
 _release_seat(struct SeatItem *item)
 {
+   if (item->events)
+     {
+        _pointer_motion_flush(item);
+        _seat_latency_print(item);
+        metrics_seat_del(&item->metrics);
+     }
+   _seat_view_clear(item);
    if (item->pointer)
      wl_pointer_destroy(item->pointer);
    if (item->keyboard)
      wl_keyboard_destroy(item->keyboard);
    if (item->seat)
      wl_seat_destroy(item->seat);
+   if (item->events)
+     event_log_ring_close(item->events);
    wl_list_remove(&item->link);
    free(item->name);
-   free(item);
+   eina_hash_del(item->ctx->seat_ids, &item->id, item);
+   seat_table_del(item->ctx->seat_table, item->table_id);
 }
 
 static void
@@ -282,6 +634,10 @@ _seat_name(void *data, struct wl_seat *seat, const char *name)
 
    item->name = strdup(name);
    EINA_SAFETY_ON_NULL_GOTO(item->name, err_name);
+   item->events = event_log_ring_new(name);
+   EINA_SAFETY_ON_NULL_GOTO(item->events, err_name);
+   metrics_seat_add(&item->metrics, name);
+   _seat_row_take(item);
 
    _print_seat_cap(item, false);
 
@@ -320,27 +676,41 @@ _registry_global_add(void *data,
 {
    struct SeatItem *item;
    struct Context *ctx = data;
+   unsigned table_id;
 
    if (!strcmp(interface, wl_seat_interface.name))
      {
 
         printf("Found the seat interface with id '%"PRIu32"'\n", id);
-        item = calloc(1, sizeof(struct SeatItem));
-        EINA_SAFETY_ON_NULL_RETURN(item);
-
+        item = seat_table_add(ctx->seat_table, &table_id);
+        if (!item)
+          {
+             printf("Too many seats, '%"PRIu32"' is left out\n", id);
+             return;
+          }
+        item->table_id = table_id;
+        item->ctx = ctx;
+        item->view.slot = -1;
+
+        item->version = version < SEAT_INTERFACE_VERSION ?
+           version : SEAT_INTERFACE_VERSION;
         item->seat = wl_registry_bind(wl_registry, id, &wl_seat_interface,
-                                      SEAT_INTERFACE_VERSION);
+                                      item->version);
         EINA_SAFETY_ON_NULL_GOTO(item->seat, err_seat);
         item->id = id;
+        EINA_SAFETY_ON_FALSE_GOTO(eina_hash_add(ctx->seat_ids, &id, item),
+                                  err_id);
 
         wl_seat_add_listener(item->seat, &_seat_listener, item);
         wl_list_insert(&ctx->seats, &item->link);
      }
    else if (!strcmp(interface, wl_compositor_interface.name))
      {
+        ctx->compositor_version = version < COMPOSITOR_INTERFACE_VERSION ?
+           version : COMPOSITOR_INTERFACE_VERSION;
         ctx->compositor = wl_registry_bind(wl_registry, id,
                                            &wl_compositor_interface,
-                                           COMPOSITOR_INTERFACE_VERSION);
+                                           ctx->compositor_version);
      }
    else if (!strcmp(interface, wl_shell_interface.name))
      {
@@ -355,8 +725,10 @@ _registry_global_add(void *data,
 
    return;
 
+ err_id:
+   wl_seat_destroy(item->seat);
  err_seat:
-   free(item);
+   seat_table_del(ctx->seat_table, table_id);
 }
 
 static void
@@ -367,13 +739,9 @@ _registry_global_remove(void *data,
    struct Context *ctx = data;
    struct SeatItem *item;
 
-   wl_list_for_each(item, &ctx->seats, link) {
-      if (item->id == id)
-        {
-           _release_seat(item);
-           break;
-        }
-   }
+   item = eina_hash_find(ctx->seat_ids, &id);
+   if (item)
+     _release_seat(item);
 }
 
 static const struct wl_registry_listener _registry_listener = {
@@ -410,60 +778,280 @@ static const struct wl_shell_surface_listener _ss_listener = {
 };
 
 static void
-buffer_release(void *data, struct wl_buffer *buffer)
+_buffer_release(void *data, struct wl_buffer *buffer)
 {
-   struct Context *ctx = data;
-   wl_buffer_destroy(buffer);
-   ctx->buffer = NULL;
-   printf("buffer destroy\n");
+   struct Buffer *b = data;
+
+   b->busy = false;
 }
 
 static const struct wl_buffer_listener _buffer_listener = {
-  .release = buffer_release
+  .release = _buffer_release
 };
 
-static int
-_setup_buffer(struct Context *ctx, struct wl_surface *surface)
+static size_t
+_pool_size(const struct Pool *p, unsigned nbuffers)
 {
-   int fd, r;
-   //FIXME: Hardcoded /tmp path
-   static const char template[] = "/tmp/multi-seat-XXXXXX";
-   char final_path[sizeof(template)];
-   struct wl_shm_pool *pool;
-   struct wl_buffer *buffer;
+   size_t size = (size_t)nbuffers * BUFFER_SIZE;
 
-   snprintf(final_path, sizeof(final_path), "%s", template);
-   fd = mkostemp(final_path, O_CLOEXEC);
-   EINA_SAFETY_ON_TRUE_RETURN_VAL(fd == -1, -1);
-   unlink(final_path);
+   /* Huge pages are only mapped whole */
+   if (p->huge)
+     size = (size + HUGE_PAGE_SIZE - 1) & ~((size_t)HUGE_PAGE_SIZE - 1);
+   return size;
+}
 
-   r = ftruncate(fd, BUFFER_SIZE);
-   EINA_SAFETY_ON_TRUE_GOTO(r == -1, err_truncate);
+/* Huge pages are only reserved once mapped, so their lack shows there
+   and not when the memfd is sized */
+static bool
+_pool_map(struct Pool *p, bool huge, unsigned nbuffers)
+{
+   unsigned flags = MFD_CLOEXEC | MFD_ALLOW_SEALING;
+
+   p->huge = huge;
+   p->size = _pool_size(p, nbuffers);
+   p->fd = memfd_create("multi-seat", flags | (huge ? MFD_HUGETLB : 0));
+   if (p->fd == -1)
+     return false;
+   if (ftruncate(p->fd, p->size) == -1)
+     goto err;
+   p->data = mmap(NULL, p->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                  p->fd, 0);
+   if (p->data == MAP_FAILED)
+     goto err;
+   return true;
 
-   pool = wl_shm_create_pool(ctx->shm, fd, BUFFER_SIZE);
-   r = -1;
-   EINA_SAFETY_ON_NULL_GOTO(pool, err_truncate);
+ err:
+   close(p->fd);
+   p->fd = -1;
+   return false;
+}
 
-   buffer = wl_shm_pool_create_buffer(pool, 0,
-                                      WIDTH, HEIGHT,
-                                      STRIDE,
-                                      WL_SHM_FORMAT_XRGB8888);
-   EINA_SAFETY_ON_NULL_GOTO(buffer, err_buffer);
+static bool
+_pool_init(struct Pool *p, struct wl_shm *shm, bool huge)
+{
+   memset(p, 0, sizeof(struct Pool));
+   /* A hugetlb mapping is not grown reliably, it gets room for every
+      buffer up front: they fit in the same huge pages anyway */
+   if (huge && !_pool_map(p, true, BUFFERS_MAX))
+     {
+        printf("No huge pages, using regular ones\n");
+        huge = false;
+     }
+   if (!huge)
+     EINA_SAFETY_ON_FALSE_RETURN_VAL(_pool_map(p, false, BUFFERS_MIN),
+                                     false);
+
+   /* The compositor maps it too, it must never shrink under it */
+   EINA_SAFETY_ON_TRUE_GOTO(fcntl(p->fd, F_ADD_SEALS,
+                                  F_SEAL_SHRINK | F_SEAL_SEAL) == -1,
+                            err_pool);
+   p->pool = wl_shm_create_pool(shm, p->fd, p->size);
+   EINA_SAFETY_ON_NULL_GOTO(p->pool, err_pool);
+   return true;
+
+ err_pool:
+   munmap(p->data, p->size);
+   close(p->fd);
+   return false;
+}
 
-   wl_surface_attach(surface, buffer, 0, 0);
-   wl_buffer_add_listener(buffer, &_buffer_listener, ctx);
-   ctx->buffer = buffer;
-   r = 0;
+static void
+_pool_free(struct Pool *p)
+{
+   unsigned i;
 
- err_buffer:
-   wl_shm_pool_destroy(pool);
- err_truncate:
-   close(fd);
+   for (i = 0; i < p->nbuffers; i++)
+     wl_buffer_destroy(p->buffers[i].buffer);
+   wl_shm_pool_destroy(p->pool);
+   munmap(p->data, p->size);
+   close(p->fd);
+}
 
-   return r;
+/* Existing buffers keep their offsets, only the mapping may move */
+static bool
+_pool_grow(struct Pool *p, size_t size)
+{
+   char *data;
+
+   if (size <= p->size)
+     return true;
+   /* Mapped whole by _pool_init() */
+   if (p->huge)
+     return false;
+   if (ftruncate(p->fd, size) == -1)
+     return false;
+   data = mremap(p->data, p->size, size, MREMAP_MAYMOVE);
+   if (data == MAP_FAILED)
+     return false;
+   p->data = data;
+   p->size = size;
+   wl_shm_pool_resize(p->pool, size);
+   return true;
+}
+
+static struct Buffer *
+_pool_buffer_add(struct Pool *p)
+{
+   struct Buffer *b = &p->buffers[p->nbuffers];
+
+   if (!_pool_grow(p, _pool_size(p, p->nbuffers + 1)))
+     return NULL;
+   b->buffer = wl_shm_pool_create_buffer(p->pool, p->nbuffers * BUFFER_SIZE,
+                                         WIDTH, HEIGHT, STRIDE,
+                                         WL_SHM_FORMAT_XRGB8888);
+   EINA_SAFETY_ON_NULL_RETURN_VAL(b->buffer, NULL);
+   wl_buffer_add_listener(b->buffer, &_buffer_listener, b);
+   b->busy = false;
+   /* Never drawn, the whole of it is due */
+   b->damage.n = 1;
+   EINA_RECTANGLE_SET(&b->damage.rects[0], 0, 0, WIDTH, HEIGHT);
+   p->nbuffers++;
+   return b;
+}
+
+/* A buffer the compositor is done with, NULL while it holds them all */
+static struct Buffer *
+_pool_buffer_get(struct Pool *p)
+{
+   unsigned i;
+
+   for (i = 0; i < p->nbuffers; i++)
+     if (!p->buffers[i].busy)
+       return &p->buffers[i];
+   if (p->nbuffers == BUFFERS_MAX)
+     return NULL;
+   return _pool_buffer_add(p);
+}
+
+static void *
+_buffer_data(const struct Pool *p, const struct Buffer *b)
+{
+   return p->data + (b - p->buffers) * BUFFER_SIZE;
+}
+
+/* The buffer goes to the compositor until released */
+static void
+_buffer_attach(struct wl_surface *surface, struct Buffer *b)
+{
+   wl_surface_attach(surface, b->buffer, 0, 0);
+   b->busy = true;
+}
+
+static void
+_fill(uint32_t *px, const Eina_Rectangle *clip, int x, int y, int w, int h,
+      uint32_t color)
+{
+   Eina_Rectangle r;
+
+   EINA_RECTANGLE_SET(&r, x, y, w, h);
+   if (!eina_rectangle_intersection(&r, clip))
+     return;
+   pixel_fill(px + r.y * WIDTH + r.x, WIDTH, r.w, r.h, color);
+}
+
+static uint32_t
+_seat_color(const struct SeatItem *item)
+{
+   return _seat_colors[item->id % EINA_C_ARRAY_LENGTH(_seat_colors)];
+}
+
+static void
+_seat_row_draw(const struct SeatItem *item, uint32_t *px,
+               const Eina_Rectangle *clip)
+{
+   uint32_t color = _seat_color(item), key, gray;
+   int y, b;
+   unsigned i, n;
+
+   if (item->view.slot < 0)
+     return;
+   y = item->view.slot * ROW_HEIGHT + (ROW_HEIGHT - BOX) / 2;
+   _fill(px, clip, 4, y, BOX, BOX, color);
+   for (b = 1; b <= 3; b++)
+     _fill(px, clip, ROW_BUTTONS_X + (b - 1) * ROW_HEIGHT, y, BOX, BOX,
+           item->view.buttons & (1 << b) ? color : RELEASED);
+
+   /* The latest key first, its code picks the shade */
+   n = item->view.nkeys < KEYS_MAX ? item->view.nkeys : KEYS_MAX;
+   for (i = 0; i < n; i++)
+     {
+        key = item->view.keys[(item->view.nkeys - 1 - i) % KEYS_MAX];
+        gray = 0x60 + key * 37 % 0xa0;
+        _fill(px, clip, ROW_KEYS_X + i * ROW_HEIGHT, y, BOX, BOX,
+              gray * 0x010101);
+     }
+}
+
+static void
+_scene_draw(struct Context *ctx, uint32_t *px, const Eina_Rectangle *clip)
+{
+   struct SeatItem *item;
+
+   _fill(px, clip, 0, 0, WIDTH, HEIGHT, BACKGROUND);
+   wl_list_for_each(item, &ctx->seats, link)
+     _seat_row_draw(item, px, clip);
+   /* Pointers go over every row */
+   wl_list_for_each(item, &ctx->seats, link)
+     if (item->view.inside)
+       _fill(px, clip, item->view.x - BOX / 2, item->view.y - BOX / 2,
+             BOX, BOX, _seat_color(item));
+}
+
+static void
+_frame_done(void *data, struct wl_callback *callback, uint32_t time)
+{
+   struct Context *ctx = data;
+
+   wl_callback_destroy(callback);
+   ctx->frame = NULL;
+}
+
+static const struct wl_callback_listener _frame_listener = {
+  .done = _frame_done
+};
+
+/* Draws at most once per frame callback and only what changed, an idle
+   client never wakes up for it */
+static void
+_render(struct Context *ctx)
+{
+   struct Buffer *b;
+   Eina_Rectangle *r;
+   uint32_t *px;
+   unsigned i;
+
+   if (ctx->frame || !ctx->damage.n)
+     return;
+   /* Tried again once a release is dispatched */
+   b = _pool_buffer_get(&ctx->pool);
+   if (!b)
+     return;
+
+   px = _buffer_data(&ctx->pool, b);
+   for (i = 0; i < b->damage.n; i++)
+     _scene_draw(ctx, px, &b->damage.rects[i]);
+   b->damage.n = 0;
+
+   _buffer_attach(ctx->surface, b);
+   for (i = 0; i < ctx->damage.n; i++)
+     {
+        r = &ctx->damage.rects[i];
+        if (ctx->compositor_version >= WL_SURFACE_DAMAGE_BUFFER_SINCE_VERSION)
+          wl_surface_damage_buffer(ctx->surface, r->x, r->y, r->w, r->h);
+        else
+          wl_surface_damage(ctx->surface, r->x, r->y, r->w, r->h);
+     }
+   ctx->damage.n = 0;
+
+   ctx->frame = wl_surface_frame(ctx->surface);
+   if (ctx->frame)
+     wl_callback_add_listener(ctx->frame, &_frame_listener, ctx);
+   wl_surface_commit(ctx->surface);
+   _seats_rendered(ctx);
 }
 
 static bool stop = false;
+static volatile sig_atomic_t dump = 0;
 
 static void
 _sig_action(int signum)
@@ -471,6 +1059,12 @@ _sig_action(int signum)
    stop = true;
 }
 
+static void
+_sig_user(int signum)
+{
+   dump = 1;
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -482,17 +1076,55 @@ main(int argc, char *argv[])
    struct wl_surface *surface;
    struct SeatItem *item, *tmp;
    struct sigaction sa;
+   const char *trace = NULL;
+   bool huge = false;
+   int opt;
 
+   while ((opt = getopt(argc, argv, "Hr:")) != -1)
+     {
+        switch (opt)
+          {
+           case 'H':
+              huge = true;
+              break;
+           case 'r':
+              trace = optarg;
+              break;
+           default:
+              fprintf(stderr, "Usage: %s [-H] [-r trace]\n"
+                      "  -H        back the buffers with huge pages\n"
+                      "  -r trace  record the input of every seat to trace\n",
+                      argv[0]);
+              return -1;
+          }
+     }
+
+   memset(&ctx, 0, sizeof(ctx));
    wl_list_init(&ctx.seats);
 
    sa.sa_handler = _sig_action;
    sigemptyset(&sa.sa_mask);
    sa.sa_flags = SA_RESETHAND;
    sigaction(SIGINT, &sa, NULL);
+   /* Interrupts the poll below, the loop dumps the metrics */
+   sa.sa_handler = _sig_user;
+   sa.sa_flags = 0;
+   sigaction(SIGUSR1, &sa, NULL);
+
+   EINA_SAFETY_ON_TRUE_RETURN_VAL(eina_init() == 0, r);
+   pixel_init();
+   EINA_SAFETY_ON_FALSE_GOTO(event_log_init(_event_print), err_log);
+   if (trace && !event_log_trace_start(trace, EVENT_TRACE_WAYLAND))
+     goto err_trace;
+   metrics_init("multi-seat-wayland", METRIC_MASK(METRIC_EVENTS));
+   ctx.seat_table = seat_table_new(sizeof(struct SeatItem), SEATS_MAX);
+   EINA_SAFETY_ON_NULL_GOTO(ctx.seat_table, err_table);
+   ctx.seat_ids = eina_hash_int32_new(NULL);
+   EINA_SAFETY_ON_NULL_GOTO(ctx.seat_ids, err_ids);
 
    printf("Trying to connect to Wayland\n");
    display = wl_display_connect(NULL);
-   EINA_SAFETY_ON_NULL_RETURN_VAL(display, r );
+   EINA_SAFETY_ON_NULL_GOTO(display, err_display);
 
    registry = wl_display_get_registry(display);
    EINA_SAFETY_ON_NULL_GOTO(registry, err_registry);
@@ -514,24 +1146,38 @@ main(int argc, char *argv[])
 
    wl_shell_surface_add_listener(shell_surface, &_ss_listener, NULL);
    wl_shell_surface_set_toplevel(shell_surface);
-   wl_surface_damage(surface, 0, 0, 800, 600);
-   r = _setup_buffer(&ctx, surface);
-   EINA_SAFETY_ON_TRUE_GOTO(r == -1, err_buffer);
-   wl_surface_commit(surface);
+   EINA_SAFETY_ON_FALSE_GOTO(_pool_init(&ctx.pool, ctx.shm, huge), err_pool);
+   ctx.surface = surface;
+   /* The first frame draws everything */
+   _surface_damage(&ctx, 0, 0, WIDTH, HEIGHT);
 
    while (!stop) {
-      struct pollfd pfd;
+      struct pollfd pfd[2];
 
       r = wl_display_dispatch_pending(display);
       EINA_SAFETY_ON_TRUE_GOTO(r == -1, err_loop);
+      _render(&ctx);
       r = wl_display_flush(display);
       EINA_SAFETY_ON_TRUE_GOTO(r == -1, err_loop);
-
-      pfd.fd = wl_display_get_fd(display);
-      pfd.events = POLLIN;
-      pfd.revents = 0;
-      poll(&pfd, 1, -1);
-      if (pfd.revents & POLLIN)
+      _seats_flushed(&ctx);
+
+      if (dump) {
+         dump = 0;
+         /* stdout is busy with the input events */
+         metrics_dump(stderr);
+      }
+
+      pfd[0].fd = wl_display_get_fd(display);
+      pfd[0].events = POLLIN;
+      pfd[0].revents = 0;
+      /* Left out while -1 */
+      pfd[1].fd = metrics_fd();
+      pfd[1].events = POLLIN;
+      pfd[1].revents = 0;
+      poll(pfd, 2, -1);
+      if (pfd[1].revents & POLLIN)
+         metrics_serve();
+      if (pfd[0].revents & POLLIN)
          wl_display_dispatch(display);
    }
 
@@ -542,10 +1188,10 @@ main(int argc, char *argv[])
    }
 
  err_loop:
-   /* it may be destroyed on buffer_release already */
-   if (ctx.buffer)
-       wl_buffer_destroy(ctx.buffer);
- err_buffer:
+   if (ctx.frame)
+     wl_callback_destroy(ctx.frame);
+   _pool_free(&ctx.pool);
+ err_pool:
    wl_shell_destroy(ctx.shell);
    wl_shm_destroy(ctx.shm);
    wl_compositor_destroy(ctx.compositor);
@@ -556,6 +1202,16 @@ main(int argc, char *argv[])
  err_registry:
    wl_display_disconnect(display);
    printf("Disconnected from display\n");
+ err_display:
+   eina_hash_free(ctx.seat_ids);
+ err_ids:
+   seat_table_free(ctx.seat_table);
+ err_table:
+   metrics_shutdown();
+ err_trace:
+   event_log_shutdown();
+ err_log:
+   eina_shutdown();
 
    return r;
 }
@@ -0,0 +1,312 @@
+/* Times the pixel kernels of every implementation the CPU runs on whole
+   frames of a few sizes: fills, blits, a frame composited over another
+   the cursors of many seats composited over a frame and frames hashed in
+   tiles. Results of each implementation are checked against the scalar
+   ones first. */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <Eina.h>
+
+#include "pixel.h"
+#include "bench-stats.h"
+
+#define CURSOR (32)
+#define TILE (32)
+
+enum Bench_Case {
+   CASE_FILL,
+   CASE_BLIT,
+   CASE_OVER,
+   CASE_CURSORS,
+   CASE_HASH,
+   CASE_LAST
+};
+
+static const char *const case_names[CASE_LAST] = {
+   "fill", "blit", "over", "cursors", "hash"
+};
+
+struct Frame {
+   int w, h;
+   uint32_t *dst;
+   uint32_t *src;
+   uint32_t *cursor;
+   /* Where each seat cursor goes */
+   int *pos;
+   unsigned seats;
+   /* All the tile hashes folded together */
+   uint64_t hash;
+};
+
+static uint32_t
+_premul_random(void)
+{
+   uint32_t a, r;
+   int i;
+
+   /* Some transparent and some opaque, as in cursors and overlays */
+   switch (rand() % 4)
+     {
+      case 0: return 0;
+      case 1: a = 255; break;
+      default: a = rand() % 256; break;
+     }
+   r = a << 24;
+   for (i = 0; i < 24; i += 8)
+     r |= (rand() % (a + 1)) << i;
+   return r;
+}
+
+static void
+_cursor_draw(uint32_t *cursor)
+{
+   int x, y, d2, r2 = (CURSOR / 2 - 2) * (CURSOR / 2 - 2);
+   uint32_t a;
+
+   for (y = 0; y < CURSOR; y++)
+     for (x = 0; x < CURSOR; x++)
+       {
+          d2 = (x - CURSOR / 2) * (x - CURSOR / 2) +
+             (y - CURSOR / 2) * (y - CURSOR / 2);
+          /* An opaque disc with a soft edge */
+          if (d2 <= r2)
+            a = 255;
+          else if (d2 <= r2 + 4 * CURSOR)
+            a = 255 - (d2 - r2) * 255 / (4 * CURSOR);
+          else
+            a = 0;
+          cursor[y * CURSOR + x] = a << 24 | (a * 0xe0 / 255) << 16 |
+             (a * 0x40 / 255) << 8 | (a * 0x40 / 255);
+       }
+}
+
+static Eina_Bool
+_frame_init(struct Frame *f, int w, int h, unsigned seats)
+{
+   size_t n = (size_t)w * h, i;
+
+   f->w = w;
+   f->h = h;
+   f->seats = seats;
+   f->dst = malloc(n * 4);
+   f->src = malloc(n * 4);
+   f->cursor = malloc(CURSOR * CURSOR * 4);
+   f->pos = malloc(seats * 2 * sizeof(int));
+   if (!f->dst || !f->src || !f->cursor || !f->pos)
+     return EINA_FALSE;
+
+   for (i = 0; i < n; i++)
+     {
+        f->dst[i] = 0xff000000 | (rand() & 0xffffff);
+        f->src[i] = _premul_random();
+     }
+   _cursor_draw(f->cursor);
+   for (i = 0; i < seats; i++)
+     {
+        f->pos[i * 2] = rand() % (w - CURSOR);
+        f->pos[i * 2 + 1] = rand() % (h - CURSOR);
+     }
+   return EINA_TRUE;
+}
+
+static void
+_frame_free(struct Frame *f)
+{
+   free(f->dst);
+   free(f->src);
+   free(f->cursor);
+   free(f->pos);
+}
+
+static void
+_case_run(enum Bench_Case c, struct Frame *f)
+{
+   unsigned i;
+   int x, y;
+
+   switch (c)
+     {
+      case CASE_FILL:
+         pixel_fill(f->dst, f->w, f->w, f->h, 0xff202020);
+         break;
+      case CASE_BLIT:
+         pixel_blit(f->dst, f->w, f->src, f->w, f->w, f->h);
+         break;
+      case CASE_OVER:
+         pixel_over(f->dst, f->w, f->src, f->w, f->w, f->h);
+         break;
+      case CASE_CURSORS:
+         for (i = 0; i < f->seats; i++)
+           pixel_over(f->dst + f->pos[i * 2 + 1] * f->w + f->pos[i * 2],
+                      f->w, f->cursor, CURSOR, CURSOR, CURSOR);
+         break;
+      case CASE_HASH:
+         f->hash = 0;
+         for (y = 0; y < f->h; y += TILE)
+           for (x = 0; x < f->w; x += TILE)
+             f->hash ^= pixel_hash(f->src + y * f->w + x, f->w,
+                                   f->w - x < TILE ? f->w - x : TILE,
+                                   f->h - y < TILE ? f->h - y : TILE);
+         break;
+      default:
+         break;
+     }
+}
+
+/* Pixels touched by one run */
+static double
+_case_pixels(enum Bench_Case c, const struct Frame *f)
+{
+   if (c == CASE_CURSORS)
+     return (double)f->seats * CURSOR * CURSOR;
+   return (double)f->w * f->h;
+}
+
+/* The same starting frame through each implementation must give the
+   same bytes as the scalar one */
+static Eina_Bool
+_case_check(enum Bench_Case c, struct Frame *f, enum Pixel_Impl impl)
+{
+   size_t size = (size_t)f->w * f->h * 4;
+   uint32_t *start, *expected;
+   uint64_t hash;
+   Eina_Bool r;
+
+   start = malloc(size);
+   expected = malloc(size);
+   if (!start || !expected)
+     {
+        free(start);
+        free(expected);
+        return EINA_FALSE;
+     }
+   memcpy(start, f->dst, size);
+
+   pixel_impl_set(PIXEL_SCALAR);
+   _case_run(c, f);
+   memcpy(expected, f->dst, size);
+   hash = f->hash;
+
+   memcpy(f->dst, start, size);
+   pixel_impl_set(impl);
+   _case_run(c, f);
+   r = !memcmp(expected, f->dst, size) && hash == f->hash;
+
+   memcpy(f->dst, start, size);
+   free(start);
+   free(expected);
+   return r;
+}
+
+/* Milliseconds per run */
+static double
+_case_time(enum Bench_Case c, struct Frame *f, double seconds)
+{
+   double start = bench_now(), elapsed;
+   unsigned long runs = 0;
+
+   do
+     {
+        _case_run(c, f);
+        runs++;
+        elapsed = bench_now() - start;
+     }
+   while (elapsed < seconds);
+   return elapsed * 1000 / runs;
+}
+
+static void
+_usage(const char *name)
+{
+   fprintf(stderr, "Usage: %s [-s WxH] [-n seats] [-t seconds]\n", name);
+}
+
+int
+main(int argc, char **argv)
+{
+   static const int default_sizes[][2] = {
+      { 800, 600 }, { 1920, 1080 }, { 3840, 2160 }
+   };
+   int sizes[3][2], nsizes = 0, opt, s, r = 1;
+   unsigned seats = 64;
+   double seconds = 0.2, ms, scalar_ms;
+   enum Bench_Case c;
+   enum Pixel_Impl impl;
+   struct Frame f;
+
+   while ((opt = getopt(argc, argv, "s:n:t:")) != -1)
+     {
+        switch (opt)
+          {
+           case 's':
+              if (nsizes == 3 ||
+                  sscanf(optarg, "%dx%d", &sizes[nsizes][0],
+                         &sizes[nsizes][1]) != 2 ||
+                  sizes[nsizes][0] <= CURSOR || sizes[nsizes][1] <= CURSOR)
+                {
+                   _usage(argv[0]);
+                   return 1;
+                }
+              nsizes++;
+              break;
+           case 'n': seats = atoi(optarg); break;
+           case 't': seconds = atof(optarg); break;
+           default:
+              _usage(argv[0]);
+              return 1;
+          }
+     }
+   if (!nsizes)
+     {
+        memcpy(sizes, default_sizes, sizeof(sizes));
+        nsizes = 3;
+     }
+
+   eina_init();
+   pixel_init();
+   printf("Best implementation: %s\n", pixel_impl_name(pixel_impl_get()));
+   printf("%-8s %10s %-7s %10s %10s %8s\n", "kernel", "size", "impl",
+          "ms/frame", "Mpix/s", "speedup");
+
+   for (s = 0; s < nsizes; s++)
+     {
+        memset(&f, 0, sizeof(f));
+        EINA_SAFETY_ON_FALSE_GOTO(_frame_init(&f, sizes[s][0], sizes[s][1],
+                                              seats), end);
+        for (c = 0; c < CASE_LAST; c++)
+          {
+             scalar_ms = 0;
+             for (impl = 0; impl < PIXEL_IMPL_LAST; impl++)
+               {
+                  if (!pixel_impl_set(impl))
+                    continue;
+                  if (!_case_check(c, &f, impl))
+                    {
+                       fprintf(stderr, "%s %s differs from scalar\n",
+                               case_names[c], pixel_impl_name(impl));
+                       goto end;
+                    }
+                  ms = _case_time(c, &f, seconds);
+                  if (impl == PIXEL_SCALAR)
+                    scalar_ms = ms;
+                  printf("%-8s %5dx%-4d %-7s %10.3f %10.1f %7.2fx\n",
+                         case_names[c], f.w, f.h, pixel_impl_name(impl), ms,
+                         _case_pixels(c, &f) / ms / 1000,
+                         scalar_ms / ms);
+               }
+          }
+        _frame_free(&f);
+     }
+   r = 0;
+   memset(&f, 0, sizeof(f));
+
+ end:
+   _frame_free(&f);
+   eina_shutdown();
+   return r;
+}
@@ -0,0 +1,430 @@
+#include <stdlib.h>
+#include <string.h>
+#include "pixel.h"
+
+/* Pixel hashes run one xxHash32 like lane for every sixteenth pixel of a
+   row, vectors hash 16 pixels a step in independent chains and all give
+   the same result */
+#define HASH_LANES (16)
+#define HASH_P1 (0x9e3779b1U)
+#define HASH_P2 (0x85ebca77U)
+#define HASH_K1 (0x9e3779b185ebca87ULL)
+#define HASH_K2 (0xc2b2ae3d27d4eb4fULL)
+
+#if defined(__x86_64__) || defined(__i386__)
+# define PIXEL_X86
+# include <immintrin.h>
+#endif
+
+/* Kernels work on a single span, the rectangle loops are shared. Hashes
+   take the whole rectangle to keep their lanes in registers. */
+struct Kernels {
+   void (*fill)(uint32_t *dst, int w, uint32_t color);
+   void (*over)(uint32_t *dst, const uint32_t *src, int w);
+   void (*hash)(uint32_t *lanes, const uint32_t *src, int stride,
+                int w, int h);
+};
+
+static const char *const impl_names[PIXEL_IMPL_LAST] = {
+   [PIXEL_SCALAR] = "scalar",
+   [PIXEL_SSE2] = "sse2",
+   [PIXEL_AVX2] = "avx2",
+};
+
+static void
+_fill_scalar(uint32_t *dst, int w, uint32_t color)
+{
+   int i;
+
+   for (i = 0; i < w; i++)
+     dst[i] = color;
+}
+
+/* d * (255 - a) / 255, rounded, the way the vector paths do it */
+static inline uint32_t
+_over_pixel(uint32_t s, uint32_t d)
+{
+   uint32_t ia = 255 - (s >> 24), r = 0, t, c;
+   int shift;
+
+   for (shift = 0; shift < 32; shift += 8)
+     {
+        t = ((d >> shift) & 0xff) * ia + 128;
+        c = ((t + (t >> 8)) >> 8) + ((s >> shift) & 0xff);
+        r |= (c > 255 ? 255 : c) << shift;
+     }
+   return r;
+}
+
+static void
+_over_scalar(uint32_t *dst, const uint32_t *src, int w)
+{
+   uint32_t s;
+   int i;
+
+   for (i = 0; i < w; i++)
+     {
+        s = src[i];
+        /* Both give what blending would, only faster */
+        if (s >> 24 == 0xff)
+          dst[i] = s;
+        else if (s)
+          dst[i] = _over_pixel(s, dst[i]);
+     }
+}
+
+static inline uint32_t
+_hash_round(uint32_t lane, uint32_t v)
+{
+   lane += v * HASH_P2;
+   lane = (lane << 13) | (lane >> 19);
+   return lane * HASH_P1;
+}
+
+static void
+_hash_span(uint32_t *lanes, const uint32_t *src, int w)
+{
+   int i;
+
+   for (i = 0; i < w; i++)
+     lanes[i % HASH_LANES] = _hash_round(lanes[i % HASH_LANES], src[i]);
+}
+
+static void
+_hash_scalar(uint32_t *lanes, const uint32_t *src, int stride, int w, int h)
+{
+   int y;
+
+   for (y = 0; y < h; y++, src += stride)
+     _hash_span(lanes, src, w);
+}
+
+#ifdef PIXEL_X86
+__attribute__((target("sse2"))) static void
+_fill_sse2(uint32_t *dst, int w, uint32_t color)
+{
+   __m128i c = _mm_set1_epi32(color);
+   int i;
+
+   for (i = 0; i + 4 <= w; i += 4)
+     _mm_storeu_si128((__m128i *)(dst + i), c);
+   for (; i < w; i++)
+     dst[i] = color;
+}
+
+__attribute__((target("sse2"))) static inline __m128i
+_over_sse2_half(__m128i s, __m128i d)
+{
+   __m128i ia, t;
+
+   ia = _mm_sub_epi16(_mm_set1_epi16(255), s);
+   ia = _mm_shufflehi_epi16(_mm_shufflelo_epi16(ia, 0xff), 0xff);
+   t = _mm_add_epi16(_mm_mullo_epi16(d, ia), _mm_set1_epi16(128));
+   t = _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+   return _mm_add_epi16(t, s);
+}
+
+__attribute__((target("sse2"))) static void
+_over_sse2(uint32_t *dst, const uint32_t *src, int w)
+{
+   __m128i zero = _mm_setzero_si128(), opaque = _mm_set1_epi32(0xff000000);
+   __m128i s, d, lo, hi;
+   int i;
+
+   for (i = 0; i + 4 <= w; i += 4)
+     {
+        s = _mm_loadu_si128((const __m128i *)(src + i));
+        /* Cursors are mostly fully transparent or opaque */
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(s, zero)) == 0xffff)
+          continue;
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(s, opaque),
+                                              opaque)) == 0xffff)
+          {
+             _mm_storeu_si128((__m128i *)(dst + i), s);
+             continue;
+          }
+        d = _mm_loadu_si128((const __m128i *)(dst + i));
+        lo = _over_sse2_half(_mm_unpacklo_epi8(s, zero),
+                             _mm_unpacklo_epi8(d, zero));
+        hi = _over_sse2_half(_mm_unpackhi_epi8(s, zero),
+                             _mm_unpackhi_epi8(d, zero));
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi16(lo, hi));
+     }
+   _over_scalar(dst + i, src + i, w - i);
+}
+
+/* SSE2 has no 32 bits multiply keeping the low halves */
+__attribute__((target("sse2"))) static inline __m128i
+_mullo_sse2(__m128i a, __m128i b)
+{
+   __m128i even, odd;
+
+   even = _mm_mul_epu32(a, b);
+   odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+   return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+                             _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+__attribute__((target("sse2"))) static inline __m128i
+_hash_round_sse2(__m128i lane, __m128i v)
+{
+   lane = _mm_add_epi32(lane, _mullo_sse2(v, _mm_set1_epi32(HASH_P2)));
+   lane = _mm_or_si128(_mm_slli_epi32(lane, 13), _mm_srli_epi32(lane, 19));
+   return _mullo_sse2(lane, _mm_set1_epi32(HASH_P1));
+}
+
+__attribute__((target("sse2"))) static void
+_hash_sse2(uint32_t *lanes, const uint32_t *src, int stride, int w, int h)
+{
+   __m128i l[HASH_LANES / 4];
+   int i, j, y;
+
+   for (y = 0; y < h; y++, src += stride)
+     {
+        for (j = 0; j < HASH_LANES / 4; j++)
+          l[j] = _mm_loadu_si128((const __m128i *)(lanes + j * 4));
+        for (i = 0; i + HASH_LANES <= w; i += HASH_LANES)
+          for (j = 0; j < HASH_LANES / 4; j++)
+            l[j] = _hash_round_sse2(
+               l[j], _mm_loadu_si128((const __m128i *)(src + i + j * 4)));
+        for (j = 0; j < HASH_LANES / 4; j++)
+          _mm_storeu_si128((__m128i *)(lanes + j * 4), l[j]);
+        _hash_span(lanes, src + i, w - i);
+     }
+}
+
+__attribute__((target("avx2"))) static void
+_fill_avx2(uint32_t *dst, int w, uint32_t color)
+{
+   __m256i c = _mm256_set1_epi32(color);
+   int i;
+
+   for (i = 0; i + 8 <= w; i += 8)
+     _mm256_storeu_si256((__m256i *)(dst + i), c);
+   for (; i < w; i++)
+     dst[i] = color;
+}
+
+__attribute__((target("avx2"))) static inline __m256i
+_over_avx2_half(__m256i s, __m256i d)
+{
+   __m256i ia, t;
+
+   ia = _mm256_sub_epi16(_mm256_set1_epi16(255), s);
+   ia = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(ia, 0xff), 0xff);
+   t = _mm256_add_epi16(_mm256_mullo_epi16(d, ia), _mm256_set1_epi16(128));
+   t = _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+   return _mm256_add_epi16(t, s);
+}
+
+/* Unpacking and packing both work within 128 bits lanes, so pixels come
+   back where they were */
+__attribute__((target("avx2"))) static void
+_over_avx2(uint32_t *dst, const uint32_t *src, int w)
+{
+   __m256i zero = _mm256_setzero_si256();
+   __m256i opaque = _mm256_set1_epi32(0xff000000);
+   __m256i s, d, lo, hi;
+   int i;
+
+   for (i = 0; i + 8 <= w; i += 8)
+     {
+        s = _mm256_loadu_si256((const __m256i *)(src + i));
+        if (_mm256_testz_si256(s, s))
+          continue;
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi32(
+                 _mm256_and_si256(s, opaque), opaque)) == -1)
+          {
+             _mm256_storeu_si256((__m256i *)(dst + i), s);
+             continue;
+          }
+        d = _mm256_loadu_si256((const __m256i *)(dst + i));
+        lo = _over_avx2_half(_mm256_unpacklo_epi8(s, zero),
+                             _mm256_unpacklo_epi8(d, zero));
+        hi = _over_avx2_half(_mm256_unpackhi_epi8(s, zero),
+                             _mm256_unpackhi_epi8(d, zero));
+        _mm256_storeu_si256((__m256i *)(dst + i),
+                            _mm256_packus_epi16(lo, hi));
+     }
+   _over_sse2(dst + i, src + i, w - i);
+}
+
+__attribute__((target("avx2"))) static inline __m256i
+_hash_round_avx2(__m256i lane, __m256i v)
+{
+   lane = _mm256_add_epi32(lane,
+                           _mm256_mullo_epi32(v, _mm256_set1_epi32(HASH_P2)));
+   lane = _mm256_or_si256(_mm256_slli_epi32(lane, 13),
+                          _mm256_srli_epi32(lane, 19));
+   return _mm256_mullo_epi32(lane, _mm256_set1_epi32(HASH_P1));
+}
+
+/* Rows as wide as the lanes, tiles mostly are, stay in registers */
+__attribute__((target("avx2"))) static void
+_hash_avx2(uint32_t *lanes, const uint32_t *src, int stride, int w, int h)
+{
+   __m256i lo, hi;
+   int i, y;
+
+   lo = _mm256_loadu_si256((const __m256i *)lanes);
+   hi = _mm256_loadu_si256((const __m256i *)(lanes + 8));
+   for (y = 0; y < h; y++, src += stride)
+     {
+        for (i = 0; i + HASH_LANES <= w; i += HASH_LANES)
+          {
+             lo = _hash_round_avx2(
+                lo, _mm256_loadu_si256((const __m256i *)(src + i)));
+             hi = _hash_round_avx2(
+                hi, _mm256_loadu_si256((const __m256i *)(src + i + 8)));
+          }
+        if (i < w)
+          {
+             _mm256_storeu_si256((__m256i *)lanes, lo);
+             _mm256_storeu_si256((__m256i *)(lanes + 8), hi);
+             _hash_span(lanes, src + i, w - i);
+             lo = _mm256_loadu_si256((const __m256i *)lanes);
+             hi = _mm256_loadu_si256((const __m256i *)(lanes + 8));
+          }
+     }
+   _mm256_storeu_si256((__m256i *)lanes, lo);
+   _mm256_storeu_si256((__m256i *)(lanes + 8), hi);
+}
+#endif
+
+static const struct Kernels kernels[PIXEL_IMPL_LAST] = {
+   [PIXEL_SCALAR] = { _fill_scalar, _over_scalar, _hash_scalar },
+#ifdef PIXEL_X86
+   [PIXEL_SSE2] = { _fill_sse2, _over_sse2, _hash_sse2 },
+   [PIXEL_AVX2] = { _fill_avx2, _over_avx2, _hash_avx2 },
+#endif
+};
+
+static enum Pixel_Impl impl = PIXEL_SCALAR;
+
+static Eina_Bool
+_impl_supported(enum Pixel_Impl i)
+{
+   switch (i)
+     {
+      case PIXEL_SCALAR:
+         return EINA_TRUE;
+#ifdef PIXEL_X86
+      case PIXEL_SSE2:
+         return !!__builtin_cpu_supports("sse2");
+      case PIXEL_AVX2:
+         return !!__builtin_cpu_supports("avx2");
+#endif
+      default:
+         return EINA_FALSE;
+     }
+}
+
+void
+pixel_init(void)
+{
+   const char *forced = getenv("PIXEL_IMPL");
+   int i;
+
+   __builtin_cpu_init();
+   if (forced)
+     for (i = 0; i < PIXEL_IMPL_LAST; i++)
+       if (!strcmp(forced, impl_names[i]) && pixel_impl_set(i))
+         return;
+
+   for (i = PIXEL_IMPL_LAST - 1; i >= 0; i--)
+     if (pixel_impl_set(i))
+       return;
+}
+
+Eina_Bool
+pixel_impl_set(enum Pixel_Impl i)
+{
+   if (i >= PIXEL_IMPL_LAST || !_impl_supported(i))
+     return EINA_FALSE;
+   impl = i;
+   return EINA_TRUE;
+}
+
+enum Pixel_Impl
+pixel_impl_get(void)
+{
+   return impl;
+}
+
+const char *
+pixel_impl_name(enum Pixel_Impl i)
+{
+   return i < PIXEL_IMPL_LAST ? impl_names[i] : NULL;
+}
+
+void
+pixel_fill(uint32_t *dst, int stride, int w, int h, uint32_t color)
+{
+   int y;
+
+   if (w <= 0)
+     return;
+   /* A whole buffer is one span */
+   if (w == stride)
+     {
+        kernels[impl].fill(dst, w * h, color);
+        return;
+     }
+   for (y = 0; y < h; y++, dst += stride)
+     kernels[impl].fill(dst, w, color);
+}
+
+/* libc already picks the best copy for the CPU */
+void
+pixel_blit(uint32_t *dst, int dst_stride,
+           const uint32_t *src, int src_stride, int w, int h)
+{
+   int y;
+
+   if (w <= 0)
+     return;
+   if (w == dst_stride && w == src_stride)
+     {
+        memcpy(dst, src, (size_t)w * h * 4);
+        return;
+     }
+   for (y = 0; y < h; y++, dst += dst_stride, src += src_stride)
+     memcpy(dst, src, (size_t)w * 4);
+}
+
+void
+pixel_over(uint32_t *dst, int dst_stride,
+           const uint32_t *src, int src_stride, int w, int h)
+{
+   int y;
+
+   if (w <= 0)
+     return;
+   for (y = 0; y < h; y++, dst += dst_stride, src += src_stride)
+     kernels[impl].over(dst, src, w);
+}
+
+/* Rows go through the lanes one after the other, the lanes are folded
+   together with the size at the end */
+uint64_t
+pixel_hash(const uint32_t *src, int stride, int w, int h)
+{
+   uint32_t lanes[HASH_LANES];
+   uint64_t hash = HASH_K1 ^ ((uint64_t)w << 32 | (uint32_t)h);
+   int i;
+
+   for (i = 0; i < HASH_LANES; i++)
+     lanes[i] = HASH_P1 * (i + 1);
+   if (w > 0)
+     kernels[impl].hash(lanes, src, stride, w, h);
+
+   for (i = 0; i < HASH_LANES; i++)
+     {
+        hash ^= lanes[i] * HASH_K2;
+        hash = ((hash << 31) | (hash >> 33)) * HASH_K1;
+     }
+   hash ^= hash >> 33;
+   hash *= HASH_K2;
+   hash ^= hash >> 29;
+   return hash;
+}
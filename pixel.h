@@ -0,0 +1,33 @@
+#ifndef PIXEL_H
+#define PIXEL_H
+
+#include <stdint.h>
+#include <Eina.h>
+
+/* Pixel kernels for 32 bits buffers, ARGB32 or XRGB8888. Strides are in
+   pixels. Sources composited over are premultiplied, as Evas and
+   wl_shm ARGB buffers are. Every implementation gives the same bytes. */
+
+enum Pixel_Impl {
+   PIXEL_SCALAR,
+   PIXEL_SSE2,
+   PIXEL_AVX2,
+   PIXEL_IMPL_LAST
+};
+
+/* Picks the best the CPU runs, PIXEL_IMPL=scalar|sse2|avx2 forces one */
+void pixel_init(void);
+/* EINA_FALSE if the CPU does not run it */
+Eina_Bool pixel_impl_set(enum Pixel_Impl impl);
+enum Pixel_Impl pixel_impl_get(void);
+const char *pixel_impl_name(enum Pixel_Impl impl);
+
+void pixel_fill(uint32_t *dst, int stride, int w, int h, uint32_t color);
+void pixel_blit(uint32_t *dst, int dst_stride,
+                const uint32_t *src, int src_stride, int w, int h);
+void pixel_over(uint32_t *dst, int dst_stride,
+                const uint32_t *src, int src_stride, int w, int h);
+/* Tells whether pixels changed, not meant to resist anything else */
+uint64_t pixel_hash(const uint32_t *src, int stride, int w, int h);
+
+#endif
@@ -0,0 +1,116 @@
+/* Lists what a multi-seat-vnc -R recording holds, from its start or from
+   the keyframe before a given time: when each update was sent, its size,
+   its rectangles and the pixel format of each keyframe, and the updates
+   the recording misses. */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <Eina.h>
+
+#include "vnc-record.h"
+
+static const char *const type_names[] = {
+   "format", "update", "keyframe", "gap"
+};
+
+static const char *const gap_reasons[] = {
+   "encoded by libvncserver", "dropped"
+};
+
+static void
+_usage(const char *name)
+{
+   fprintf(stderr, "Usage: %s [-s seconds] recording.rec\n", name);
+}
+
+static void
+_entry_print(const struct Record_Entry *entry, const Eina_Binbuf *data)
+{
+   const unsigned char *p = eina_binbuf_string_get(data);
+   const struct Record_Gap *g;
+   const rfbPixelFormat *f;
+
+   printf("%10.3f %-8s %8u", entry->time / 1000.0,
+          entry->type <= RECORD_GAP ? type_names[entry->type] : "?",
+          entry->length);
+   if (entry->type == RECORD_GAP && entry->length == sizeof(*g))
+     {
+        g = (const struct Record_Gap *)p;
+        printf("  %u bytes %s", g->length,
+               g->reason <= RECORD_GAP_DROPPED ? gap_reasons[g->reason] :
+               "missed");
+     }
+   else if (entry->type == RECORD_FORMAT && entry->length == sizeof(*f))
+     {
+        f = (const rfbPixelFormat *)p;
+        printf("  %u bpp, depth %u, %s endian", f->bitsPerPixel, f->depth,
+               f->bigEndian ? "big" : "little");
+     }
+   else if (entry->length >= 4)
+     /* FramebufferUpdate: type, padding, rectangles */
+     printf("  %u rects", p[2] << 8 | p[3]);
+   printf("\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+   struct Record_Header header;
+   struct Record_Entry entry;
+   Record_Reader *rd;
+   Eina_Binbuf *data;
+   unsigned long n = 0, gaps = 0;
+   double seek = -1;
+   int opt, r = 1;
+
+   while ((opt = getopt(argc, argv, "s:")) != -1)
+     {
+        switch (opt)
+          {
+           case 's': seek = atof(optarg); break;
+           default:
+              _usage(argv[0]);
+              return 1;
+          }
+     }
+   if (optind != argc - 1)
+     {
+        _usage(argv[0]);
+        return 1;
+     }
+
+   eina_init();
+   rd = record_reader_open(argv[optind], &header);
+   if (!rd)
+     goto err_open;
+   data = eina_binbuf_new();
+   EINA_SAFETY_ON_NULL_GOTO(data, err_data);
+   if (seek >= 0 && !record_reader_seek(rd, seek * 1000))
+     {
+        fprintf(stderr, "No keyframe before %.3fs\n", seek);
+        goto err_seek;
+     }
+
+   printf("%ux%u\n%10s %-8s %8s\n", header.width, header.height, "time",
+          "type", "bytes");
+   while (record_reader_next(rd, &entry, data))
+     {
+        _entry_print(&entry, data);
+        if (entry.type == RECORD_GAP)
+          gaps++;
+        n++;
+     }
+   printf("%lu entries, %lu gaps\n", n, gaps);
+   r = 0;
+
+ err_seek:
+   eina_binbuf_free(data);
+ err_data:
+   record_reader_close(rd);
+ err_open:
+   eina_shutdown();
+   return r;
+}
@@ -0,0 +1,633 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <rfb/rfbproto.h>
+
+#include "rfb-client.h"
+#include "vnc-shm.h"
+
+/* Everything parsed in one piece fits here, bigger payloads are skipped as
+   they come */
+#define IN_SIZE (64 * 1024)
+#define HEXTILE (16)
+
+enum Rfb_State {
+   STATE_VERSION,
+   STATE_SECURITY,
+   STATE_SECURITY_RESULT,
+   STATE_SERVER_INIT,
+   STATE_SERVER_NAME,
+   STATE_MESSAGE,
+   STATE_COLOUR_MAP,
+   STATE_CUT_TEXT,
+   STATE_RECT,
+   STATE_HEXTILE,
+   STATE_HEXTILE_SUBRECTS
+};
+
+struct _Rfb_Client {
+   int fd;
+   /* On the Unix socket, the frame buffer is mapped rather than sent */
+   Eina_Bool local;
+   int shm_fd;
+   void *shm;
+   size_t shm_size;
+   enum Rfb_State state;
+   const Rfb_Client_Cb *cb;
+   void *data;
+   int width, height;
+   /* Rectangles left in the current update */
+   unsigned rects;
+   /* Current hextile rectangle and the position in it */
+   int rx, ry, rw, rh, tx, ty;
+   unsigned char hextile_flags;
+   /* Bytes of the current payload still to throw away */
+   size_t skip;
+   unsigned char in[IN_SIZE];
+   size_t in_len, in_pos;
+   unsigned long long received;
+   Eina_Binbuf *out;
+   size_t out_sent;
+};
+
+static inline unsigned
+_get16(const unsigned char *p)
+{
+   return p[0] << 8 | p[1];
+}
+
+static inline uint32_t
+_get32(const unsigned char *p)
+{
+   return (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+static Eina_Bool
+_put(Rfb_Client *c, const unsigned char *b, size_t len)
+{
+   return eina_binbuf_append_length(c->out, b, len);
+}
+
+static Eina_Bool
+_put16(Rfb_Client *c, uint16_t v)
+{
+   unsigned char b[2] = { v >> 8, v };
+
+   return _put(c, b, sizeof(b));
+}
+
+static Eina_Bool
+_put32(Rfb_Client *c, uint32_t v)
+{
+   unsigned char b[4] = { v >> 24, v >> 16, v >> 8, v };
+
+   return _put(c, b, sizeof(b));
+}
+
+/* 32 bits little endian true colour, whatever the server has */
+static Eina_Bool
+_pixel_format_send(Rfb_Client *c)
+{
+   unsigned char b[20] = {
+      rfbSetPixelFormat, 0, 0, 0,
+      32, 24, 0, 1, 0, 255, 0, 255, 0, 255, 16, 8, 0, 0, 0, 0
+   };
+
+   return _put(c, b, sizeof(b));
+}
+
+static Eina_Bool
+_encodings_send(Rfb_Client *c)
+{
+   static const uint32_t encodings[] = {
+      SHM_ENCODING,
+      rfbEncodingHextile, rfbEncodingCopyRect, rfbEncodingRaw,
+      rfbEncodingRichCursor, rfbEncodingXCursor, rfbEncodingPointerPos
+   };
+   unsigned char b[2] = { rfbSetEncodings, 0 };
+   unsigned i, n = sizeof(encodings) / sizeof(encodings[0]);
+
+   /* Only a local client can map the frame buffer */
+   i = c->local ? 0 : 1;
+   if (!_put(c, b, sizeof(b)) || !_put16(c, n - i))
+     return EINA_FALSE;
+   for (; i < n; i++)
+     if (!_put32(c, encodings[i]))
+       return EINA_FALSE;
+   return EINA_TRUE;
+}
+
+static int
+_shm_map(Rfb_Client *c, int w, int h)
+{
+   if (c->shm_fd == -1 || c->shm)
+     {
+        fprintf(stderr, "Unexpected shared frame buffer\n");
+        return -1;
+     }
+   c->shm_size = (size_t)w * h * 4;
+   c->shm = mmap(NULL, c->shm_size, PROT_READ, MAP_SHARED, c->shm_fd, 0);
+   close(c->shm_fd);
+   c->shm_fd = -1;
+   if (c->shm == MAP_FAILED)
+     {
+        perror("Shared frame buffer");
+        c->shm = NULL;
+        return -1;
+     }
+   return 0;
+}
+
+/* Takes the rectangle header, returns -1 for what cannot be skipped */
+static int
+_rect_start(Rfb_Client *c, const unsigned char *p)
+{
+   int w = _get16(p + 4), h = _get16(p + 6);
+   uint32_t encoding = _get32(p + 8);
+
+   c->rx = _get16(p);
+   c->ry = _get16(p + 2);
+   c->rw = w;
+   c->rh = h;
+   switch (encoding)
+     {
+      case rfbEncodingRaw:
+         c->skip = (size_t)w * h * 4;
+         break;
+      case rfbEncodingCopyRect:
+         c->skip = 4;
+         break;
+      case rfbEncodingHextile:
+         c->tx = c->ty = 0;
+         if (w && h)
+           c->state = STATE_HEXTILE;
+         break;
+      case rfbEncodingRichCursor:
+         c->skip = (size_t)w * h * 4 + (size_t)(w + 7) / 8 * h;
+         break;
+      case rfbEncodingXCursor:
+         if (w && h)
+           c->skip = 6 + 2 * (size_t)(w + 7) / 8 * h;
+         break;
+      case rfbEncodingPointerPos:
+         break;
+      case rfbEncodingLastRect:
+         c->rects = 1;
+         break;
+      case SHM_ENCODING_FD:
+         if (_shm_map(c, w, h) < 0)
+           return -1;
+         break;
+      /* Already in the mapping */
+      case SHM_ENCODING:
+         break;
+      default:
+         fprintf(stderr, "Unexpected encoding %d\n", (int)encoding);
+         return -1;
+     }
+   c->rects--;
+   return 0;
+}
+
+static void
+_hextile_next(Rfb_Client *c)
+{
+   c->tx += HEXTILE;
+   if (c->tx < c->rw)
+     return;
+   c->tx = 0;
+   c->ty += HEXTILE;
+   if (c->ty < c->rh)
+     return;
+   c->state = STATE_RECT;
+}
+
+static void
+_update_check(Rfb_Client *c)
+{
+   if (c->state != STATE_RECT || c->rects)
+     return;
+   c->state = STATE_MESSAGE;
+   if (c->cb->update)
+     c->cb->update(c->data, c);
+}
+
+/* Parses as much as possible of what was received, returns -1 on
+   protocol errors */
+static int
+_parse(Rfb_Client *c)
+{
+   const unsigned char *p;
+   size_t avail, n;
+   int tw, th;
+
+#define NEED(len) do { if (avail < (len)) return 0; } while (0)
+#define TAKE(len) c->in_pos += (len)
+
+   for (;;)
+     {
+        avail = c->in_len - c->in_pos;
+        if (c->skip)
+          {
+             n = c->skip < avail ? c->skip : avail;
+             c->skip -= n;
+             TAKE(n);
+             if (c->skip)
+               return 0;
+             _update_check(c);
+             continue;
+          }
+        p = c->in + c->in_pos;
+
+        switch (c->state)
+          {
+           case STATE_VERSION:
+              NEED(12);
+              if (memcmp(p, "RFB ", 4))
+                return -1;
+              TAKE(12);
+              if (!_put(c, (const unsigned char *)"RFB 003.008\n", 12))
+                return -1;
+              c->state = STATE_SECURITY;
+              break;
+           case STATE_SECURITY:
+              NEED(1);
+              NEED(1 + (size_t)p[0]);
+              if (!p[0] || !memchr(p + 1, rfbSecTypeNone, p[0]))
+                return -1;
+              TAKE(1 + (size_t)p[0]);
+              if (!eina_binbuf_append_char(c->out, rfbSecTypeNone))
+                return -1;
+              c->state = STATE_SECURITY_RESULT;
+              break;
+           case STATE_SECURITY_RESULT:
+              NEED(4);
+              if (_get32(p))
+                return -1;
+              TAKE(4);
+              /* Shared, other seats are other connections anyway */
+              if (!eina_binbuf_append_char(c->out, 1))
+                return -1;
+              c->state = STATE_SERVER_INIT;
+              break;
+           case STATE_SERVER_INIT:
+              NEED(24);
+              c->width = _get16(p);
+              c->height = _get16(p + 2);
+              c->skip = _get32(p + 20);
+              TAKE(24);
+              c->state = STATE_SERVER_NAME;
+              break;
+           case STATE_SERVER_NAME:
+              /* Mapped pixels stay in the server format */
+              if ((!c->local && !_pixel_format_send(c)) ||
+                  !_encodings_send(c))
+                return -1;
+              c->state = STATE_MESSAGE;
+              if (c->cb->ready)
+                c->cb->ready(c->data, c);
+              break;
+           case STATE_MESSAGE:
+              NEED(1);
+              switch (p[0])
+                {
+                 case rfbFramebufferUpdate:
+                    NEED(4);
+                    c->rects = _get16(p + 2);
+                    TAKE(4);
+                    c->state = STATE_RECT;
+                    _update_check(c);
+                    break;
+                 case rfbSetColourMapEntries:
+                    c->state = STATE_COLOUR_MAP;
+                    break;
+                 case rfbBell:
+                    TAKE(1);
+                    break;
+                 case rfbServerCutText:
+                    c->state = STATE_CUT_TEXT;
+                    break;
+                 default:
+                    fprintf(stderr, "Unexpected message %d\n", p[0]);
+                    return -1;
+                }
+              break;
+           case STATE_COLOUR_MAP:
+              NEED(6);
+              c->skip = 6 * (size_t)_get16(p + 4);
+              TAKE(6);
+              c->state = STATE_MESSAGE;
+              break;
+           case STATE_CUT_TEXT:
+              NEED(8);
+              c->skip = _get32(p + 4);
+              TAKE(8);
+              c->state = STATE_MESSAGE;
+              break;
+           case STATE_RECT:
+              NEED(12);
+              if (_rect_start(c, p) < 0)
+                return -1;
+              TAKE(12);
+              _update_check(c);
+              break;
+           case STATE_HEXTILE:
+              NEED(1);
+              tw = c->rw - c->tx < HEXTILE ? c->rw - c->tx : HEXTILE;
+              th = c->rh - c->ty < HEXTILE ? c->rh - c->ty : HEXTILE;
+              c->hextile_flags = p[0];
+              if (p[0] & rfbHextileRaw)
+                {
+                   TAKE(1);
+                   c->skip = (size_t)tw * th * 4;
+                   _hextile_next(c);
+                   break;
+                }
+              n = 1;
+              if (p[0] & rfbHextileBackgroundSpecified)
+                n += 4;
+              if (p[0] & rfbHextileForegroundSpecified)
+                n += 4;
+              NEED(n);
+              TAKE(n);
+              if (c->hextile_flags & rfbHextileAnySubrects)
+                c->state = STATE_HEXTILE_SUBRECTS;
+              else
+                {
+                   _hextile_next(c);
+                   _update_check(c);
+                }
+              break;
+           case STATE_HEXTILE_SUBRECTS:
+              NEED(1);
+              n = (c->hextile_flags & rfbHextileSubrectsColoured) ? 6 : 2;
+              c->skip = n * p[0];
+              TAKE(1);
+              c->state = STATE_HEXTILE;
+              _hextile_next(c);
+              if (!c->skip)
+                _update_check(c);
+              break;
+          }
+     }
+
+#undef NEED
+#undef TAKE
+}
+
+static Rfb_Client *
+_client_new(const Rfb_Client_Cb *cb, void *data)
+{
+   Rfb_Client *c;
+
+   c = calloc(1, sizeof(Rfb_Client));
+   EINA_SAFETY_ON_NULL_RETURN_VAL(c, NULL);
+   c->cb = cb;
+   c->data = data;
+   c->fd = -1;
+   c->shm_fd = -1;
+   c->out = eina_binbuf_new();
+   EINA_SAFETY_ON_NULL_GOTO(c->out, err_out);
+   return c;
+
+ err_out:
+   free(c);
+   return NULL;
+}
+
+Rfb_Client *
+rfb_client_connect(const char *host, int port, const Rfb_Client_Cb *cb,
+                   void *data)
+{
+   struct addrinfo hints = { 0 }, *ai, *it;
+   Rfb_Client *c;
+   char service[16];
+   int one = 1;
+
+   c = _client_new(cb, data);
+   if (!c)
+     return NULL;
+
+   hints.ai_socktype = SOCK_STREAM;
+   snprintf(service, sizeof(service), "%d", port);
+   if (getaddrinfo(host, service, &hints, &ai))
+     goto err_addr;
+   for (it = ai; it; it = it->ai_next)
+     {
+        c->fd = socket(it->ai_family, it->ai_socktype | SOCK_NONBLOCK |
+                       SOCK_CLOEXEC, it->ai_protocol);
+        if (c->fd == -1)
+          continue;
+        if (!connect(c->fd, it->ai_addr, it->ai_addrlen) ||
+            errno == EINPROGRESS)
+          break;
+        close(c->fd);
+        c->fd = -1;
+     }
+   freeaddrinfo(ai);
+   if (c->fd == -1)
+     goto err_addr;
+   setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+   return c;
+
+ err_addr:
+   rfb_client_free(c);
+   return NULL;
+}
+
+Rfb_Client *
+rfb_client_connect_local(const char *path, const Rfb_Client_Cb *cb,
+                         void *data)
+{
+   struct sockaddr_un addr = { .sun_family = AF_UNIX };
+   Rfb_Client *c;
+
+   EINA_SAFETY_ON_TRUE_RETURN_VAL(strlen(path) >= sizeof(addr.sun_path),
+                                  NULL);
+   strcpy(addr.sun_path, path);
+   c = _client_new(cb, data);
+   if (!c)
+     return NULL;
+   c->local = EINA_TRUE;
+   c->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+   if (c->fd == -1)
+     goto err;
+   /* Unix sockets connect right away, or fail with a full backlog */
+   if (connect(c->fd, (struct sockaddr *)&addr, sizeof(addr)) == -1)
+     goto err;
+   return c;
+
+ err:
+   rfb_client_free(c);
+   return NULL;
+}
+
+void
+rfb_client_free(Rfb_Client *c)
+{
+   if (c->fd != -1)
+     close(c->fd);
+   if (c->shm_fd != -1)
+     close(c->shm_fd);
+   if (c->shm)
+     munmap(c->shm, c->shm_size);
+   eina_binbuf_free(c->out);
+   free(c);
+}
+
+int
+rfb_client_fd(const Rfb_Client *c)
+{
+   return c->fd;
+}
+
+int
+rfb_client_width(const Rfb_Client *c)
+{
+   return c->width;
+}
+
+int
+rfb_client_height(const Rfb_Client *c)
+{
+   return c->height;
+}
+
+unsigned long long
+rfb_client_received(const Rfb_Client *c)
+{
+   return c->received;
+}
+
+const void *
+rfb_client_framebuffer(const Rfb_Client *c)
+{
+   return c->shm;
+}
+
+/* Local connections may get a descriptor along with the data */
+static ssize_t
+_recv(Rfb_Client *c, void *buf, size_t len)
+{
+   union {
+      struct cmsghdr hdr;
+      char buf[CMSG_SPACE(sizeof(int))];
+   } control;
+   struct iovec iov = { buf, len };
+   struct msghdr msg = { 0 };
+   struct cmsghdr *cmsg;
+   ssize_t n;
+   int fd;
+
+   if (!c->local)
+     return recv(c->fd, buf, len, 0);
+
+   msg.msg_iov = &iov;
+   msg.msg_iovlen = 1;
+   msg.msg_control = control.buf;
+   msg.msg_controllen = sizeof(control.buf);
+   n = recvmsg(c->fd, &msg, MSG_CMSG_CLOEXEC);
+   if (n < 0)
+     return n;
+   for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+     {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+          continue;
+        memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+        if (c->shm_fd != -1)
+          close(c->shm_fd);
+        c->shm_fd = fd;
+     }
+   return n;
+}
+
+int
+rfb_client_read(Rfb_Client *c)
+{
+   ssize_t n;
+
+   for (;;)
+     {
+        if (c->in_len == IN_SIZE)
+          {
+             /* Nothing parsed out of a full buffer */
+             if (!c->in_pos)
+               return -1;
+             memmove(c->in, c->in + c->in_pos, c->in_len - c->in_pos);
+             c->in_len -= c->in_pos;
+             c->in_pos = 0;
+          }
+        n = _recv(c, c->in + c->in_len, IN_SIZE - c->in_len);
+        if (n < 0 && errno == EINTR)
+          continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+          break;
+        if (n <= 0)
+          return -1;
+        c->in_len += n;
+        c->received += n;
+        if (_parse(c) < 0)
+          return -1;
+        if (c->in_pos == c->in_len)
+          c->in_pos = c->in_len = 0;
+     }
+   return rfb_client_flush(c);
+}
+
+int
+rfb_client_flush(Rfb_Client *c)
+{
+   size_t len = eina_binbuf_length_get(c->out);
+   ssize_t n;
+
+   while (c->out_sent < len)
+     {
+        n = send(c->fd, eina_binbuf_string_get(c->out) + c->out_sent,
+                 len - c->out_sent, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+          continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+          return 0;
+        if (n < 0)
+          return -1;
+        c->out_sent += n;
+     }
+   eina_binbuf_reset(c->out);
+   c->out_sent = 0;
+   return 0;
+}
+
+Eina_Bool
+rfb_client_update_request(Rfb_Client *c, Eina_Bool incremental)
+{
+   unsigned char b[2] = { rfbFramebufferUpdateRequest, !!incremental };
+
+   return _put(c, b, sizeof(b)) && _put16(c, 0) && _put16(c, 0) &&
+      _put16(c, c->width) && _put16(c, c->height);
+}
+
+Eina_Bool
+rfb_client_pointer(Rfb_Client *c, int x, int y, int buttons)
+{
+   unsigned char b[2] = { rfbPointerEvent, buttons };
+
+   return _put(c, b, sizeof(b)) && _put16(c, x) && _put16(c, y);
+}
+
+Eina_Bool
+rfb_client_key(Rfb_Client *c, unsigned keysym, Eina_Bool down)
+{
+   unsigned char b[4] = { rfbKeyEvent, !!down, 0, 0 };
+
+   return _put(c, b, sizeof(b)) && _put32(c, keysym);
+}
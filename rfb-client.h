@@ -0,0 +1,45 @@
+#ifndef RFB_CLIENT_H
+#define RFB_CLIENT_H
+
+#include <Eina.h>
+
+/* Just enough of an RFB viewer to drive the server from the benchmarks:
+   it handshakes, asks for updates and walks through what it gets without
+   decoding any pixel. Sockets are non-blocking, the caller polls them. */
+typedef struct _Rfb_Client Rfb_Client;
+
+typedef struct _Rfb_Client_Cb {
+   /* Server init received, update requests can be sent */
+   void (*ready)(void *data, Rfb_Client *c);
+   /* A whole framebuffer update was received */
+   void (*update)(void *data, Rfb_Client *c);
+} Rfb_Client_Cb;
+
+Rfb_Client *rfb_client_connect(const char *host, int port,
+                               const Rfb_Client_Cb *cb, void *data);
+/* To the Unix socket of multi-seat-vnc -L, the seat frame buffer is mapped
+   instead of sent, see vnc-shm.h */
+Rfb_Client *rfb_client_connect_local(const char *path,
+                                     const Rfb_Client_Cb *cb, void *data);
+void rfb_client_free(Rfb_Client *c);
+
+int rfb_client_fd(const Rfb_Client *c);
+int rfb_client_width(const Rfb_Client *c);
+int rfb_client_height(const Rfb_Client *c);
+/* Bytes received since connected */
+unsigned long long rfb_client_received(const Rfb_Client *c);
+/* The mapped frame buffer of a local client, NULL until the first update:
+   valid from an update to the next request */
+const void *rfb_client_framebuffer(const Rfb_Client *c);
+
+/* Reads and parses everything available, returns -1 once the connection
+   is unusable */
+int rfb_client_read(Rfb_Client *c);
+/* Sends what was queued, returns -1 on error */
+int rfb_client_flush(Rfb_Client *c);
+
+Eina_Bool rfb_client_update_request(Rfb_Client *c, Eina_Bool incremental);
+Eina_Bool rfb_client_pointer(Rfb_Client *c, int x, int y, int buttons);
+Eina_Bool rfb_client_key(Rfb_Client *c, unsigned keysym, Eina_Bool down);
+
+#endif
@@ -0,0 +1,140 @@
+#include <stdlib.h>
+#include <limits.h>
+#include <stdint.h>
+#include <string.h>
+#include "seat-table.h"
+
+#define CACHE_LINE (64)
+/* Ids per bitmap word, and per slab */
+#define WORD_BITS (64)
+#define FULL (~(uint64_t)0)
+
+struct _Seat_Table {
+   /* Rounded up to cache lines, records never share one */
+   size_t record_size;
+   unsigned max;
+   unsigned count;
+   unsigned nwords;
+   /* A bit per id, set while in use */
+   uint64_t *used;
+   /* A bit per word of used, set while it is full: the first free id is
+      found by looking at a word per 4096 ids */
+   uint64_t *full;
+   char **slabs;
+};
+
+static inline void
+_bit_set(uint64_t *bits, unsigned i)
+{
+   bits[i / WORD_BITS] |= (uint64_t)1 << (i % WORD_BITS);
+}
+
+static inline void
+_bit_clear(uint64_t *bits, unsigned i)
+{
+   bits[i / WORD_BITS] &= ~((uint64_t)1 << (i % WORD_BITS));
+}
+
+static inline Eina_Bool
+_bit_get(const uint64_t *bits, unsigned i)
+{
+   return (bits[i / WORD_BITS] >> (i % WORD_BITS)) & 1;
+}
+
+/* Marks id used and its word full when it is */
+static void
+_id_take(Seat_Table *t, unsigned id)
+{
+   _bit_set(t->used, id);
+   if (t->used[id / WORD_BITS] == FULL)
+     _bit_set(t->full, id / WORD_BITS);
+}
+
+Seat_Table *
+seat_table_new(size_t record_size, unsigned max)
+{
+   Seat_Table *t;
+   unsigned i, nfull;
+
+   EINA_SAFETY_ON_TRUE_RETURN_VAL(!max || max > UINT_MAX - WORD_BITS, NULL);
+   t = calloc(1, sizeof(Seat_Table));
+   EINA_SAFETY_ON_NULL_RETURN_VAL(t, NULL);
+   t->record_size = (record_size + CACHE_LINE - 1) /
+      CACHE_LINE * CACHE_LINE;
+   t->max = max;
+   t->nwords = (max + 1 + WORD_BITS - 1) / WORD_BITS;
+   nfull = (t->nwords + WORD_BITS - 1) / WORD_BITS;
+   t->used = calloc(t->nwords, sizeof(uint64_t));
+   EINA_SAFETY_ON_NULL_GOTO(t->used, err);
+   t->full = calloc(nfull, sizeof(uint64_t));
+   EINA_SAFETY_ON_NULL_GOTO(t->full, err);
+   t->slabs = calloc(t->nwords, sizeof(char *));
+   EINA_SAFETY_ON_NULL_GOTO(t->slabs, err);
+
+   /* 0 is no id, neither is anything past max */
+   _id_take(t, 0);
+   for (i = max + 1; i < t->nwords * WORD_BITS; i++)
+     _id_take(t, i);
+   for (i = t->nwords; i < nfull * WORD_BITS; i++)
+     _bit_set(t->full, i);
+   return t;
+
+ err:
+   seat_table_free(t);
+   return NULL;
+}
+
+void
+seat_table_free(Seat_Table *t)
+{
+   unsigned i;
+
+   if (t->slabs)
+     for (i = 0; i < t->nwords; i++)
+       free(t->slabs[i]);
+   free(t->slabs);
+   free(t->full);
+   free(t->used);
+   free(t);
+}
+
+void *
+seat_table_add(Seat_Table *t, unsigned *id)
+{
+   unsigned f, w, bit;
+   char *rec;
+
+   for (f = 0; t->full[f] == FULL; f++)
+     if ((f + 1) * WORD_BITS >= t->nwords)
+       return NULL;
+   w = f * WORD_BITS + __builtin_ctzll(~t->full[f]);
+   bit = __builtin_ctzll(~t->used[w]);
+
+   if (!t->slabs[w])
+     {
+        t->slabs[w] = aligned_alloc(CACHE_LINE, WORD_BITS * t->record_size);
+        EINA_SAFETY_ON_NULL_RETURN_VAL(t->slabs[w], NULL);
+     }
+   *id = w * WORD_BITS + bit;
+   _id_take(t, *id);
+   t->count++;
+   rec = t->slabs[w] + bit * t->record_size;
+   memset(rec, 0, t->record_size);
+   return rec;
+}
+
+void
+seat_table_del(Seat_Table *t, unsigned id)
+{
+   EINA_SAFETY_ON_TRUE_RETURN(!id || id > t->max);
+   EINA_SAFETY_ON_FALSE_RETURN(_bit_get(t->used, id));
+   _bit_clear(t->used, id);
+   _bit_clear(t->full, id / WORD_BITS);
+   t->count--;
+}
+
+unsigned
+seat_table_count(const Seat_Table *t)
+{
+   return t->count;
+}
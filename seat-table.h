@@ -0,0 +1,22 @@
+#ifndef SEAT_TABLE_H
+#define SEAT_TABLE_H
+
+#include <stddef.h>
+#include <Eina.h>
+
+/* Per seat records under small ids. Ids come from a bitmap, lowest free
+   first, and are never handed out twice while in use. Records live in
+   cache line aligned slabs, one per 64 ids, kept once allocated so seats
+   coming and going do not go through malloc. */
+typedef struct _Seat_Table Seat_Table;
+
+/* Ids go from 1 to max */
+Seat_Table *seat_table_new(size_t record_size, unsigned max);
+void seat_table_free(Seat_Table *t);
+
+/* A zeroed record and its id, NULL once every id is taken */
+void *seat_table_add(Seat_Table *t, unsigned *id);
+void seat_table_del(Seat_Table *t, unsigned id);
+unsigned seat_table_count(const Seat_Table *t);
+
+#endif
@@ -0,0 +1,287 @@
+/* Connects more and more seats to multi-seat-vnc and reports, for every
+   step of the ramp, how long the new seats took to connect and to get
+   their first update, how many updates all seats got per second and how
+   much CPU the server used meanwhile.
+
+   With -c the seats churn instead: each one hangs up as soon as the
+   server greets it and connects again, and the reconnects per second
+   are reported rather than the updates. */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <Eina.h>
+
+#include "rfb-client.h"
+#include "bench-stats.h"
+
+#define EVENTS (256)
+
+struct Bench_Seat {
+   Rfb_Client *client;
+   double start;
+   Eina_Bool updated;
+   /* Greeted while churning, to connect again */
+   Eina_Bool greeted;
+};
+
+static struct {
+   struct Bench_Seat *seats;
+   unsigned alive;
+   unsigned failed;
+   unsigned updates;
+   Eina_Bool churn;
+   unsigned reconnects;
+   /* Latencies of the seats connected in the current step, in seconds */
+   Eina_Inarray *connect;
+   Eina_Inarray *first;
+} bench;
+
+static volatile sig_atomic_t stop = 0;
+
+static void
+_ready(void *data, Rfb_Client *c)
+{
+   struct Bench_Seat *s = data;
+   double latency = bench_now() - s->start;
+
+   eina_inarray_push(bench.connect, &latency);
+   /* Freed once the read is done */
+   if (bench.churn)
+     s->greeted = EINA_TRUE;
+   else
+     rfb_client_update_request(c, EINA_FALSE);
+}
+
+static void
+_update(void *data, Rfb_Client *c)
+{
+   struct Bench_Seat *s = data;
+   double latency;
+
+   if (!s->updated)
+     {
+        latency = bench_now() - s->start;
+        eina_inarray_push(bench.first, &latency);
+        s->updated = EINA_TRUE;
+     }
+   bench.updates++;
+   rfb_client_update_request(c, EINA_TRUE);
+}
+
+static const Rfb_Client_Cb cb = { _ready, _update };
+
+static void
+_seat_close(struct Bench_Seat *s)
+{
+   rfb_client_free(s->client);
+   s->client = NULL;
+   bench.alive--;
+   bench.failed++;
+}
+
+static Eina_Bool
+_seat_open(struct Bench_Seat *s, int epoll_fd, const char *host, int port)
+{
+   struct epoll_event ev;
+
+   s->start = bench_now();
+   s->client = rfb_client_connect(host, port, &cb, s);
+   if (!s->client)
+     return EINA_FALSE;
+
+   ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+   ev.data.ptr = s;
+   if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, rfb_client_fd(s->client), &ev))
+     {
+        rfb_client_free(s->client);
+        s->client = NULL;
+        return EINA_FALSE;
+     }
+   bench.alive++;
+   return EINA_TRUE;
+}
+
+/* The server sees the seat go and a new one come */
+static void
+_seat_churn(struct Bench_Seat *s, int epoll_fd, const char *host, int port)
+{
+   rfb_client_free(s->client);
+   s->client = NULL;
+   s->greeted = EINA_FALSE;
+   bench.alive--;
+   bench.reconnects++;
+   if (!_seat_open(s, epoll_fd, host, port))
+     bench.failed++;
+}
+
+static void
+_report(double elapsed, double cpu)
+{
+   printf("%6u %6u %8.1f %8.1f", bench.alive, bench.failed,
+          bench_percentile(bench.connect, 50),
+          bench_percentile(bench.connect, 99));
+   if (bench.churn)
+     printf(" %9.0f", bench.reconnects / elapsed);
+   else
+     printf(" %8.1f %8.1f %9.0f", bench_percentile(bench.first, 50),
+            bench_percentile(bench.first, 99), bench.updates / elapsed);
+   if (cpu >= 0)
+     printf(" %6.1f", cpu * 100 / elapsed);
+   printf("\n");
+   fflush(stdout);
+
+   eina_inarray_flush(bench.connect);
+   eina_inarray_flush(bench.first);
+   bench.updates = 0;
+   bench.reconnects = 0;
+   bench.failed = 0;
+}
+
+static void
+_sig_action(int sig)
+{
+   stop = 1;
+}
+
+static void
+_usage(const char *name)
+{
+   fprintf(stderr, "Usage: %s [-n seats] [-s step] [-i seconds] [-p pid] "
+           "[-c] [host [port]]\n", name);
+}
+
+int
+main(int argc, char **argv)
+{
+   struct epoll_event ev[EVENTS];
+   struct Bench_Seat *s;
+   struct rlimit rl;
+   struct sigaction sa;
+   const char *host = "localhost";
+   double interval = 2, now, step_start;
+   double cpu = -1, prev_cpu = -1, cur_cpu;
+   unsigned total = 1000, step = 100, opened = 0, i, last;
+   int epoll_fd, port = 5900, opt, n, r = 1;
+   pid_t pid = 0;
+
+   while ((opt = getopt(argc, argv, "n:s:i:p:c")) != -1)
+     {
+        switch (opt)
+          {
+           case 'n': total = atoi(optarg); break;
+           case 's': step = atoi(optarg); break;
+           case 'i': interval = atof(optarg); break;
+           case 'p': pid = atoi(optarg); break;
+           case 'c': bench.churn = EINA_TRUE; break;
+           default:
+              _usage(argv[0]);
+              return 1;
+          }
+     }
+   if (optind < argc)
+     host = argv[optind++];
+   if (optind < argc)
+     port = atoi(argv[optind++]);
+   if (!total || !step || interval <= 0)
+     {
+        _usage(argv[0]);
+        return 1;
+     }
+
+   /* One socket per seat */
+   if (!getrlimit(RLIMIT_NOFILE, &rl) && rl.rlim_cur < total + 64)
+     {
+        rl.rlim_cur = rl.rlim_max < total + 64 ? rl.rlim_max : total + 64;
+        setrlimit(RLIMIT_NOFILE, &rl);
+     }
+
+   sa.sa_handler = _sig_action;
+   sa.sa_flags = 0;
+   sigemptyset(&sa.sa_mask);
+   sigaction(SIGINT, &sa, NULL);
+   sigaction(SIGTERM, &sa, NULL);
+
+   eina_init();
+
+   bench.seats = calloc(total, sizeof(struct Bench_Seat));
+   EINA_SAFETY_ON_NULL_GOTO(bench.seats, err_seats);
+   bench.connect = eina_inarray_new(sizeof(double), 0);
+   EINA_SAFETY_ON_NULL_GOTO(bench.connect, err_connect);
+   bench.first = eina_inarray_new(sizeof(double), 0);
+   EINA_SAFETY_ON_NULL_GOTO(bench.first, err_first);
+   epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+   EINA_SAFETY_ON_TRUE_GOTO(epoll_fd == -1, err_epoll);
+
+   printf("%6s %6s %8s %8s", "seats", "failed", "conn50", "conn99");
+   if (bench.churn)
+     printf(" %9s", "reconn/s");
+   else
+     printf(" %8s %8s %9s", "first50", "first99", "updates/s");
+   printf("%s\n", pid ? "   cpu%" : "");
+
+   if (pid)
+     prev_cpu = bench_cpu_time(pid);
+   step_start = bench_now();
+   /* The last step runs once with every seat connected */
+   for (last = 0; !stop && last < 2;)
+     {
+        if (!last)
+          {
+             for (i = 0; i < step && opened < total; i++, opened++)
+               if (!_seat_open(&bench.seats[opened], epoll_fd, host, port))
+                 bench.failed++;
+             if (opened == total)
+               last = 1;
+          }
+        else
+          last++;
+
+        while (!stop && (now = bench_now()) < step_start + interval)
+          {
+             n = epoll_wait(epoll_fd, ev, EVENTS,
+                            (int)((step_start + interval - now) * 1000) + 1);
+             for (i = 0; i < (unsigned)(n > 0 ? n : 0); i++)
+               {
+                  s = ev[i].data.ptr;
+                  if (!s->client)
+                    continue;
+                  if (rfb_client_read(s->client) < 0)
+                    _seat_close(s);
+                  else if (s->greeted)
+                    _seat_churn(s, epoll_fd, host, port);
+               }
+          }
+
+        if (pid)
+          {
+             cur_cpu = bench_cpu_time(pid);
+             cpu = cur_cpu >= 0 && prev_cpu >= 0 ? cur_cpu - prev_cpu : -1;
+             prev_cpu = cur_cpu;
+          }
+        _report(bench_now() - step_start, cpu);
+        step_start = bench_now();
+     }
+   r = 0;
+
+   for (i = 0; i < opened; i++)
+     if (bench.seats[i].client)
+       rfb_client_free(bench.seats[i].client);
+   close(epoll_fd);
+ err_epoll:
+   eina_inarray_free(bench.first);
+ err_first:
+   eina_inarray_free(bench.connect);
+ err_connect:
+   free(bench.seats);
+ err_seats:
+   eina_shutdown();
+   return r;
+}
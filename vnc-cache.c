@@ -0,0 +1,198 @@
+#include <stdlib.h>
+#include <string.h>
+#include "vnc-cache.h"
+
+#define HASH_K1 (0x9e3779b185ebca87ULL)
+#define HASH_K2 (0xc2b2ae3d27d4eb4fULL)
+
+struct Cache_Entry {
+   EINA_INLIST;
+   struct Cache_Key key;
+   size_t len;
+   unsigned char data[];
+};
+
+/* Least recently used entries are at the end of lru and evicted first */
+static struct {
+   Eina_Lock lock;
+   Eina_Hash *entries;
+   Eina_Inlist *lru;
+   size_t size;
+   size_t max;
+} cache;
+
+static inline uint64_t
+_rotl(uint64_t v, int n)
+{
+   return (v << n) | (v >> (64 - n));
+}
+
+static inline uint64_t
+_mix(uint64_t h, uint64_t v)
+{
+   return _rotl(h ^ (v * HASH_K2), 31) * HASH_K1;
+}
+
+uint64_t
+cache_tile_hash(const char *frame_buffer, int row_bytes,
+                int x, int y, int w, int h)
+{
+   const char *row;
+   uint64_t hash = HASH_K1 ^ ((uint64_t)w << 16 | h);
+   uint64_t v;
+   uint32_t tail;
+   int i, j, len = w * 4;
+
+   for (j = y; j < y + h; j++)
+     {
+        row = frame_buffer + j * row_bytes + x * 4;
+        for (i = 0; i + 8 <= len; i += 8)
+          {
+             memcpy(&v, row + i, sizeof(v));
+             hash = _mix(hash, v);
+          }
+        if (i < len)
+          {
+             memcpy(&tail, row + i, sizeof(tail));
+             hash = _mix(hash, tail);
+          }
+     }
+
+   hash ^= hash >> 33;
+   hash *= HASH_K2;
+   hash ^= hash >> 29;
+   return hash;
+}
+
+void
+cache_key_set(struct Cache_Key *key, uint64_t hash,
+              int x, int y, int w, int h, int encoding, int level,
+              const rfbPixelFormat *format)
+{
+   /* Keys are compared as memory, padding included */
+   memset(key, 0, sizeof(*key));
+   key->hash = hash;
+   key->x = x;
+   key->y = y;
+   key->w = w;
+   key->h = h;
+   key->encoding = encoding;
+   key->level = level;
+   key->format.bitsPerPixel = format->bitsPerPixel;
+   key->format.depth = format->depth;
+   key->format.bigEndian = format->bigEndian;
+   key->format.trueColour = format->trueColour;
+   key->format.redMax = format->redMax;
+   key->format.greenMax = format->greenMax;
+   key->format.blueMax = format->blueMax;
+   key->format.redShift = format->redShift;
+   key->format.greenShift = format->greenShift;
+   key->format.blueShift = format->blueShift;
+}
+
+static unsigned int
+_key_length(const void *key)
+{
+   return sizeof(struct Cache_Key);
+}
+
+static int
+_key_cmp(const void *key1, int key1_length, const void *key2, int key2_length)
+{
+   return memcmp(key1, key2, sizeof(struct Cache_Key));
+}
+
+static int
+_key_hash(const void *key, int key_length)
+{
+   const struct Cache_Key *k = key;
+
+   return (int)(k->hash ^ (k->hash >> 32) ^ ((uint32_t)k->x << 16 | k->y));
+}
+
+static void
+_entry_evict(struct Cache_Entry *e)
+{
+   cache.lru = eina_inlist_remove(cache.lru, EINA_INLIST_GET(e));
+   cache.size -= e->len;
+   eina_hash_del(cache.entries, &e->key, e);
+   free(e);
+}
+
+Eina_Bool
+cache_init(size_t max_bytes)
+{
+   EINA_SAFETY_ON_FALSE_RETURN_VAL(eina_lock_new(&cache.lock), EINA_FALSE);
+   cache.entries = eina_hash_new(_key_length, _key_cmp, _key_hash, NULL, 10);
+   EINA_SAFETY_ON_NULL_GOTO(cache.entries, err_hash);
+   cache.max = max_bytes;
+   return EINA_TRUE;
+
+ err_hash:
+   eina_lock_free(&cache.lock);
+   return EINA_FALSE;
+}
+
+void
+cache_shutdown(void)
+{
+   while (cache.lru)
+     _entry_evict(EINA_INLIST_CONTAINER_GET(cache.lru, struct Cache_Entry));
+   eina_hash_free(cache.entries);
+   cache.entries = NULL;
+   eina_lock_free(&cache.lock);
+}
+
+Eina_Bool
+cache_fetch(const struct Cache_Key *key, Eina_Binbuf *buf)
+{
+   struct Cache_Entry *e;
+   Eina_Bool r = EINA_FALSE;
+
+   eina_lock_take(&cache.lock);
+   e = eina_hash_find(cache.entries, key);
+   if (e)
+     {
+        cache.lru = eina_inlist_promote(cache.lru, EINA_INLIST_GET(e));
+        r = eina_binbuf_append_length(buf, e->data, e->len);
+     }
+   eina_lock_release(&cache.lock);
+   return r;
+}
+
+void
+cache_store(const struct Cache_Key *key, const unsigned char *data,
+            size_t len)
+{
+   struct Cache_Entry *e;
+
+   if (len > cache.max)
+     return;
+
+   e = malloc(sizeof(struct Cache_Entry) + len);
+   EINA_SAFETY_ON_NULL_RETURN(e);
+   e->key = *key;
+   e->len = len;
+   memcpy(e->data, data, len);
+
+   eina_lock_take(&cache.lock);
+   /* Another thread encoded the same tile meanwhile */
+   if (eina_hash_find(cache.entries, key))
+     {
+        eina_lock_release(&cache.lock);
+        free(e);
+        return;
+     }
+   while (cache.lru && cache.size + len > cache.max)
+     _entry_evict(EINA_INLIST_CONTAINER_GET(cache.lru->last,
+                                            struct Cache_Entry));
+   if (!eina_hash_direct_add(cache.entries, &e->key, e))
+     {
+        eina_lock_release(&cache.lock);
+        free(e);
+        return;
+     }
+   cache.lru = eina_inlist_prepend(cache.lru, EINA_INLIST_GET(e));
+   cache.size += len;
+   eina_lock_release(&cache.lock);
+}
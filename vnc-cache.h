@@ -0,0 +1,41 @@
+#ifndef VNC_CACHE_H
+#define VNC_CACHE_H
+
+#include <Eina.h>
+#include <rfb/rfb.h>
+
+/* Identifies the bytes of an encoded tile. Seats have their own frame
+   buffers, so the tile content is identified by a hash of its pixels
+   rather than by which frame it comes from. The pixels are not kept to
+   compare: two tiles of the same geometry and format with the same 64 bit
+   hash are taken as equal. With the n entries a cache holds, a lookup
+   hits the wrong one with a chance of about n / 2^64, some 10^-15 for the
+   tens of thousands of tiles in the default 16MiB. The hash is not meant
+   to resist crafted input, which is fine as long as the server draws all
+   the pixels itself. */
+struct Cache_Key {
+   uint64_t hash;
+   uint16_t x, y, w, h;
+   int32_t encoding;
+   /* compression level, 0 for the encodings without one */
+   int32_t level;
+   rfbPixelFormat format;
+};
+
+Eina_Bool cache_init(size_t max_bytes);
+void cache_shutdown(void);
+
+uint64_t cache_tile_hash(const char *frame_buffer, int row_bytes,
+                         int x, int y, int w, int h);
+
+void cache_key_set(struct Cache_Key *key, uint64_t hash,
+                   int x, int y, int w, int h, int encoding, int level,
+                   const rfbPixelFormat *format);
+
+/* Both are safe to call from the encoding threads. On a hit the cached
+   bytes are appended to buf. */
+Eina_Bool cache_fetch(const struct Cache_Key *key, Eina_Binbuf *buf);
+void cache_store(const struct Cache_Key *key, const unsigned char *data,
+                 size_t len);
+
+#endif
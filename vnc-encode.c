@@ -0,0 +1,408 @@
+#include <string.h>
+#include <stdint.h>
+#include "vnc-encode.h"
+#include "vnc-shm.h"
+
+#define HEXTILE (16)
+
+Eina_Bool
+encode_supported(int encoding)
+{
+   return encoding == rfbEncodingRaw || encoding == rfbEncodingHextile;
+}
+
+void
+encode_format_set(struct Encode_Format *f, const rfbPixelFormat *in,
+                  const rfbPixelFormat *out)
+{
+   f->in = *in;
+   f->out = *out;
+   f->identity = in->bitsPerPixel == out->bitsPerPixel &&
+      in->bigEndian == out->bigEndian &&
+      in->redMax == out->redMax && in->redShift == out->redShift &&
+      in->greenMax == out->greenMax && in->greenShift == out->greenShift &&
+      in->blueMax == out->blueMax && in->blueShift == out->blueShift;
+}
+
+static inline uint32_t
+_pixel_translate(const struct Encode_Format *f, uint32_t p)
+{
+   uint32_t r, g, b;
+
+   if (f->identity)
+     return p;
+
+   r = (p >> f->in.redShift) & f->in.redMax;
+   g = (p >> f->in.greenShift) & f->in.greenMax;
+   b = (p >> f->in.blueShift) & f->in.blueMax;
+   if (f->in.redMax != f->out.redMax)
+     r = r * f->out.redMax / f->in.redMax;
+   if (f->in.greenMax != f->out.greenMax)
+     g = g * f->out.greenMax / f->in.greenMax;
+   if (f->in.blueMax != f->out.blueMax)
+     b = b * f->out.blueMax / f->in.blueMax;
+
+   return (r << f->out.redShift) | (g << f->out.greenShift) |
+      (b << f->out.blueShift);
+}
+
+/* Writes a pixel as the client expects it, returns its size */
+static inline int
+_pixel_put(unsigned char *dst, const struct Encode_Format *f, uint32_t p)
+{
+   int i, bytes = f->out.bitsPerPixel / 8;
+
+   for (i = 0; i < bytes; i++)
+     {
+        if (f->out.bigEndian)
+          dst[bytes - 1 - i] = p >> (i * 8);
+        else
+          dst[i] = p >> (i * 8);
+     }
+   return bytes;
+}
+
+static inline uint32_t
+_pixel_get(const char *frame_buffer, int row_bytes, int x, int y)
+{
+   uint32_t p;
+
+   memcpy(&p, frame_buffer + y * row_bytes + x * 4, sizeof(p));
+   return p;
+}
+
+static Eina_Bool
+_put16(Eina_Binbuf *buf, uint16_t v)
+{
+   unsigned char b[2] = { v >> 8, v };
+
+   return eina_binbuf_append_length(buf, b, sizeof(b));
+}
+
+static Eina_Bool
+_put32(Eina_Binbuf *buf, uint32_t v)
+{
+   unsigned char b[4] = { v >> 24, v >> 16, v >> 8, v };
+
+   return eina_binbuf_append_length(buf, b, sizeof(b));
+}
+
+static Eina_Bool
+_rect_header(Eina_Binbuf *buf, int x, int y, int w, int h, int encoding)
+{
+   return _put16(buf, x) && _put16(buf, y) && _put16(buf, w) &&
+      _put16(buf, h) && _put32(buf, encoding);
+}
+
+Eina_Bool
+encode_update_header(Eina_Binbuf *buf, unsigned nrects)
+{
+   unsigned char b[2] = { rfbFramebufferUpdate, 0 };
+
+   return eina_binbuf_append_length(buf, b, sizeof(b)) && _put16(buf, nrects);
+}
+
+Eina_Bool
+encode_shm_fd(Eina_Binbuf *buf, int w, int h)
+{
+   return _rect_header(buf, 0, 0, w, h, SHM_ENCODING_FD);
+}
+
+Eina_Bool
+encode_shm_damage(Eina_Binbuf *buf, int x, int y, int w, int h)
+{
+   return _rect_header(buf, x, y, w, h, SHM_ENCODING);
+}
+
+Eina_Bool
+encode_copy_rect(Eina_Binbuf *buf, int x, int y, int w, int h,
+                 int src_x, int src_y)
+{
+   return _rect_header(buf, x, y, w, h, rfbEncodingCopyRect) &&
+      _put16(buf, src_x) && _put16(buf, src_y);
+}
+
+static Eina_Bool
+_encode_raw(Eina_Binbuf *buf, const struct Encode_Format *f,
+            const char *frame_buffer, int row_bytes,
+            int x, int y, int w, int h)
+{
+   unsigned char row[ENCODE_TILE * 4];
+   int i, j, n, len;
+
+   for (j = y; j < y + h; j++)
+     {
+        if (f->identity)
+          {
+             if (!eina_binbuf_append_length(buf, (const unsigned char *)
+                                            frame_buffer + j * row_bytes +
+                                            x * 4, w * 4))
+               return EINA_FALSE;
+             continue;
+          }
+        for (i = 0; i < w; i += ENCODE_TILE)
+          {
+             for (n = 0, len = 0; n < ENCODE_TILE && i + n < w; n++)
+               len += _pixel_put(row + len, f,
+                                 _pixel_translate(f, _pixel_get(frame_buffer,
+                                                                row_bytes,
+                                                                x + i + n,
+                                                                j)));
+             if (!eina_binbuf_append_length(buf, row, len))
+               return EINA_FALSE;
+          }
+     }
+   return EINA_TRUE;
+}
+
+struct Hextile_State {
+   uint32_t bg, fg;
+   Eina_Bool bg_valid, fg_valid;
+};
+
+/* Greedy subrectangle split of one hextile, as libvncserver does. Returns
+   the number of bytes written to out, or -1 if raw would be smaller. */
+static int
+_hextile_subrects(const uint32_t *px, int w, int h, uint32_t bg,
+                  Eina_Bool mono, const struct Encode_Format *f,
+                  unsigned char *out, int *nsubrects)
+{
+   unsigned char done[HEXTILE * HEXTILE] = { 0 };
+   int bpp = f->out.bitsPerPixel / 8;
+   int max = w * h * bpp;
+   int x, y, i, j, sw, sh, len = 0;
+   uint32_t c;
+
+   *nsubrects = 0;
+   for (y = 0; y < h; y++)
+     for (x = 0; x < w; x++)
+       {
+          c = px[y * w + x];
+          if (c == bg || done[y * w + x])
+            continue;
+
+          for (sw = 1; x + sw < w; sw++)
+            if (px[y * w + x + sw] != c || done[y * w + x + sw])
+              break;
+          for (sh = 1; y + sh < h; sh++)
+            {
+               for (i = 0; i < sw; i++)
+                 if (px[(y + sh) * w + x + i] != c ||
+                     done[(y + sh) * w + x + i])
+                   break;
+               if (i < sw)
+                 break;
+            }
+          for (j = 0; j < sh; j++)
+            memset(done + (y + j) * w + x, 1, sw);
+
+          if (len + bpp + 2 > max || *nsubrects == 255)
+            return -1;
+          if (!mono)
+            len += _pixel_put(out + len, f, c);
+          out[len++] = rfbHextilePackXY(x, y);
+          out[len++] = rfbHextilePackWH(sw, sh);
+          (*nsubrects)++;
+       }
+   return len;
+}
+
+static Eina_Bool
+_encode_hextile_tile(Eina_Binbuf *buf, struct Hextile_State *st,
+                     const struct Encode_Format *f, const char *frame_buffer,
+                     int row_bytes, int x, int y, int w, int h)
+{
+   uint32_t px[HEXTILE * HEXTILE], bg, fg = 0;
+   unsigned char sub[HEXTILE * HEXTILE * 4 + 1], pixel[4];
+   unsigned char flags = 0;
+   Eina_Bool mono = EINA_TRUE, solid = EINA_TRUE;
+   int i, j, len, nsub;
+
+   for (j = 0; j < h; j++)
+     for (i = 0; i < w; i++)
+       px[j * w + i] = _pixel_translate(f, _pixel_get(frame_buffer, row_bytes,
+                                                      x + i, y + j));
+
+   bg = px[0];
+   for (i = 1; i < w * h; i++)
+     {
+        if (px[i] == bg)
+          continue;
+        if (solid)
+          {
+             fg = px[i];
+             solid = EINA_FALSE;
+          }
+        else if (px[i] != fg)
+          {
+             mono = EINA_FALSE;
+             break;
+          }
+     }
+
+   if (!st->bg_valid || st->bg != bg)
+     flags |= rfbHextileBackgroundSpecified;
+
+   len = 0;
+   nsub = 0;
+   if (!solid)
+     {
+        len = _hextile_subrects(px, w, h, bg, mono, f, sub, &nsub);
+        if (len < 0)
+          {
+             /* Raw tiles leave background and foreground undefined */
+             st->bg_valid = st->fg_valid = EINA_FALSE;
+             if (!eina_binbuf_append_char(buf, rfbHextileRaw))
+               return EINA_FALSE;
+             return _encode_raw(buf, f, frame_buffer, row_bytes, x, y, w, h);
+          }
+        flags |= rfbHextileAnySubrects;
+        if (!mono)
+          flags |= rfbHextileSubrectsColoured;
+        else if (!st->fg_valid || st->fg != fg)
+          flags |= rfbHextileForegroundSpecified;
+     }
+
+   if (!eina_binbuf_append_char(buf, flags))
+     return EINA_FALSE;
+   if (flags & rfbHextileBackgroundSpecified)
+     {
+        if (!eina_binbuf_append_length(buf, pixel, _pixel_put(pixel, f, bg)))
+          return EINA_FALSE;
+        st->bg = bg;
+        st->bg_valid = EINA_TRUE;
+     }
+   if (flags & rfbHextileForegroundSpecified)
+     {
+        if (!eina_binbuf_append_length(buf, pixel, _pixel_put(pixel, f, fg)))
+          return EINA_FALSE;
+        st->fg = fg;
+        st->fg_valid = EINA_TRUE;
+     }
+   /* Coloured subrectangles leave the foreground undefined */
+   if (flags & rfbHextileSubrectsColoured)
+     st->fg_valid = EINA_FALSE;
+   if (flags & rfbHextileAnySubrects)
+     {
+        if (!eina_binbuf_append_char(buf, nsub))
+          return EINA_FALSE;
+        if (!eina_binbuf_append_length(buf, sub, len))
+          return EINA_FALSE;
+     }
+   return EINA_TRUE;
+}
+
+static Eina_Bool
+_encode_hextile(Eina_Binbuf *buf, const struct Encode_Format *f,
+                const char *frame_buffer, int row_bytes,
+                int x, int y, int w, int h)
+{
+   struct Hextile_State st = { 0 };
+   int i, j;
+
+   for (j = y; j < y + h; j += HEXTILE)
+     for (i = x; i < x + w; i += HEXTILE)
+       if (!_encode_hextile_tile(buf, &st, f, frame_buffer, row_bytes, i, j,
+                                 x + w - i < HEXTILE ? x + w - i : HEXTILE,
+                                 y + h - j < HEXTILE ? y + h - j : HEXTILE))
+         return EINA_FALSE;
+   return EINA_TRUE;
+}
+
+Eina_Bool
+encode_rect(Eina_Binbuf *buf, int encoding, const struct Encode_Format *f,
+            const char *frame_buffer, int row_bytes, int x, int y, int w, int h)
+{
+   if (!_rect_header(buf, x, y, w, h, encoding))
+     return EINA_FALSE;
+
+   switch (encoding)
+     {
+      case rfbEncodingRaw:
+         return _encode_raw(buf, f, frame_buffer, row_bytes, x, y, w, h);
+      case rfbEncodingHextile:
+         return _encode_hextile(buf, f, frame_buffer, row_bytes, x, y, w, h);
+      default:
+         return EINA_FALSE;
+     }
+}
+
+/* A bit per pixel, rows padded to bytes, most significant bit first */
+static Eina_Bool
+_cursor_bitmap(Eina_Binbuf *buf, const struct Encode_Cursor *c,
+               Eina_Bool (*bit)(uint32_t p, const void *data),
+               const void *data)
+{
+   unsigned char row[64];
+   int x, y, len = (c->w + 7) / 8;
+
+   if (len > (int)sizeof(row))
+     return EINA_FALSE;
+   for (y = 0; y < c->h; y++)
+     {
+        memset(row, 0, len);
+        for (x = 0; x < c->w; x++)
+          if (bit(c->pixels[y * c->w + x], data))
+            row[x / 8] |= 0x80 >> (x % 8);
+        if (!eina_binbuf_append_length(buf, row, len))
+          return EINA_FALSE;
+     }
+   return EINA_TRUE;
+}
+
+static Eina_Bool
+_cursor_mask_bit(uint32_t p, const void *data)
+{
+   return p >> 24 >= 0x80;
+}
+
+static unsigned
+_color_distance(uint32_t a, uint32_t b)
+{
+   int dr = (int)(a >> 16 & 0xff) - (int)(b >> 16 & 0xff);
+   int dg = (int)(a >> 8 & 0xff) - (int)(b >> 8 & 0xff);
+   int db = (int)(a & 0xff) - (int)(b & 0xff);
+
+   return dr * dr + dg * dg + db * db;
+}
+
+static Eina_Bool
+_cursor_fg_bit(uint32_t p, const void *data)
+{
+   const uint32_t *colors = data;
+
+   return _color_distance(p, colors[0]) < _color_distance(p, colors[1]);
+}
+
+Eina_Bool
+encode_cursor_rich(Eina_Binbuf *buf, const struct Encode_Format *f,
+                   const struct Encode_Cursor *c)
+{
+   return _rect_header(buf, c->hot_x, c->hot_y, c->w, c->h,
+                       rfbEncodingRichCursor) &&
+      _encode_raw(buf, f, (const char *)c->pixels, c->w * 4,
+                  0, 0, c->w, c->h) &&
+      _cursor_bitmap(buf, c, _cursor_mask_bit, NULL);
+}
+
+Eina_Bool
+encode_cursor_x(Eina_Binbuf *buf, const struct Encode_Cursor *c,
+                uint32_t fg, uint32_t bg)
+{
+   const uint32_t colors[2] = { fg, bg };
+   unsigned char rgb[6] = {
+      fg >> 16, fg >> 8, fg, bg >> 16, bg >> 8, bg
+   };
+
+   return _rect_header(buf, c->hot_x, c->hot_y, c->w, c->h,
+                       rfbEncodingXCursor) &&
+      eina_binbuf_append_length(buf, rgb, sizeof(rgb)) &&
+      _cursor_bitmap(buf, c, _cursor_fg_bit, colors) &&
+      _cursor_bitmap(buf, c, _cursor_mask_bit, NULL);
+}
+
+Eina_Bool
+encode_cursor_pos(Eina_Binbuf *buf, int x, int y)
+{
+   return _rect_header(buf, x, y, 0, 0, rfbEncodingPointerPos);
+}
@@ -0,0 +1,57 @@
+#ifndef VNC_ENCODE_H
+#define VNC_ENCODE_H
+
+#include <Eina.h>
+#include <rfb/rfb.h>
+
+/* Rectangles are cut in tiles of this size, each one is a rectangle of its
+   own in the update, so tiles can be encoded in any order and in parallel. */
+#define ENCODE_TILE (64)
+
+struct Encode_Format {
+   rfbPixelFormat in;
+   rfbPixelFormat out;
+   Eina_Bool identity;
+};
+
+/* Only encodings without state carried between rectangles can be encoded
+   here, the zlib based ones keep one stream per client. */
+Eina_Bool encode_supported(int encoding);
+
+void encode_format_set(struct Encode_Format *f, const rfbPixelFormat *in,
+                       const rfbPixelFormat *out);
+
+/* Appends the rectangle header and its pixels, read from the 32 bits per
+   pixel frame buffer, to buf. */
+Eina_Bool encode_rect(Eina_Binbuf *buf, int encoding,
+                      const struct Encode_Format *f, const char *frame_buffer,
+                      int row_bytes, int x, int y, int w, int h);
+
+Eina_Bool encode_copy_rect(Eina_Binbuf *buf, int x, int y, int w, int h,
+                           int src_x, int src_y);
+
+Eina_Bool encode_update_header(Eina_Binbuf *buf, unsigned nrects);
+
+/* Rectangles of a viewer reading the shared frame buffer, see vnc-shm.h */
+Eina_Bool encode_shm_fd(Eina_Binbuf *buf, int w, int h);
+Eina_Bool encode_shm_damage(Eina_Binbuf *buf, int x, int y, int w, int h);
+
+/* A cursor image, premultiplied ARGB32 like the frame buffer, and the
+   pixel it points with */
+struct Encode_Cursor {
+   int w, h;
+   int hot_x, hot_y;
+   const uint32_t *pixels;
+};
+
+/* Pseudo rectangles for viewers drawing the cursor themselves: its shape
+   in the client format, or in 2 colours for XCursor where every pixel
+   closer to fg than to bg is fg, and where the server puts it. Pixels
+   less than half opaque are left out. */
+Eina_Bool encode_cursor_rich(Eina_Binbuf *buf, const struct Encode_Format *f,
+                             const struct Encode_Cursor *c);
+Eina_Bool encode_cursor_x(Eina_Binbuf *buf, const struct Encode_Cursor *c,
+                          uint32_t fg, uint32_t bg);
+Eina_Bool encode_cursor_pos(Eina_Binbuf *buf, int x, int y);
+
+#endif
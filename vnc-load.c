@@ -0,0 +1,650 @@
+/* Opens many RFB sessions to multi-seat-vnc at once, plays an input script
+   on every one of them while asking for updates all the time, and reports
+   frame rate, bytes received, input latency and server CPU.
+
+   The server shows nothing of the input it gets, so input latency is how
+   long it takes from sending an input to receiving the first update asked
+   for after it: messages are handled in order, so by then the server went
+   through the input and rendered a frame past it.
+
+   With -t, the seats replay an input trace recorded by multi-seat-vnc -r,
+   or multi-seat-wayland -r, instead: one seat per traced seat, each input
+   sent as far from the start as it was recorded, divided by the -x speed,
+   until the whole trace is sent.
+
+   With -l, the seats connect to the Unix socket of multi-seat-vnc -L and
+   map their frame buffer, so only damage goes through the socket. */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <math.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <Eina.h>
+
+#include "rfb-client.h"
+#include "bench-stats.h"
+#include "event-trace.h"
+
+#define EVENTS (256)
+/* The input script is played with this resolution, in milliseconds */
+#define TICK_MS (1)
+/* Most trace records a seat sends in a tick, when replaying faster than
+   the updates can keep up with */
+#define REPLAY_BURST (256)
+
+enum Step_Type {
+   STEP_MOVE,
+   STEP_BUTTON,
+   STEP_KEY,
+   STEP_WAIT
+};
+
+struct Step {
+   enum Step_Type type;
+   int a, b;
+};
+
+struct Load_Seat {
+   Rfb_Client *client;
+   Eina_Bool ready;
+   /* Input script or trace position */
+   unsigned step;
+   double next_input;
+   int x, y;
+   /* Replayed records of the seat and when the replay started */
+   Eina_Inarray *trace;
+   double trace_start;
+   int buttons;
+   /* When the update request in flight was sent */
+   double request_time;
+   /* Oldest input no update was asked for after, 0 without one */
+   double input_time;
+   unsigned long frames;
+   Eina_Inarray *latency;
+};
+
+static struct {
+   struct Load_Seat *seats;
+   unsigned nseats;
+   unsigned alive;
+   Eina_Inarray *script;
+   /* Between two script steps, in seconds */
+   double interval;
+   /* Replaying a trace, 0 speed sends as fast as it can */
+   Eina_Bool replay;
+   enum Event_Trace_Source source;
+   uint32_t trace_base;
+   double speed;
+   /* Unix socket path, for seats mapping their frame buffer */
+   const char *local;
+   unsigned long dropped;
+   /* Since the last report */
+   unsigned long frames;
+   unsigned long long received;
+   Eina_Inarray *latency;
+} load;
+
+static volatile sig_atomic_t stop = 0;
+
+/* Moves around, clicks and types, never 'q' nor Escape, which make the
+   server drop the client */
+static const char default_script[] =
+   "move 100 100\n"
+   "move 200 100\n"
+   "move 200 200\n"
+   "button 1\n"
+   "move 100 200\n"
+   "key 104\n"
+   "key 101\n"
+   "key 108\n"
+   "key 108\n"
+   "key 111\n"
+   "wait 50\n";
+
+static Eina_Bool
+_script_parse_line(const char *line, unsigned n)
+{
+   struct Step step = { 0 };
+   char cmd[16];
+   int args;
+
+   if (line[0] == '#' || line[0] == '\n' || line[0] == '\0')
+     return EINA_TRUE;
+
+   args = sscanf(line, "%15s %d %d", cmd, &step.a, &step.b);
+   if (args >= 3 && !strcmp(cmd, "move"))
+     step.type = STEP_MOVE;
+   else if (args >= 2 && !strcmp(cmd, "button") && step.a > 0 && step.a <= 8)
+     step.type = STEP_BUTTON;
+   else if (args >= 2 && !strcmp(cmd, "key"))
+     step.type = STEP_KEY;
+   else if (args >= 2 && !strcmp(cmd, "wait") && step.a > 0)
+     step.type = STEP_WAIT;
+   else
+     {
+        fprintf(stderr, "Bad script line %u: %s", n, line);
+        return EINA_FALSE;
+     }
+   return eina_inarray_push(load.script, &step) >= 0;
+}
+
+/* From a file, or the default script without one */
+static Eina_Bool
+_script_load(const char *path)
+{
+   const char *p, *end;
+   char line[256];
+   unsigned n = 0;
+   FILE *f;
+
+   if (!path)
+     {
+        for (p = default_script; *p; p = end + 1)
+          {
+             end = strchr(p, '\n');
+             snprintf(line, sizeof(line), "%.*s\n", (int)(end - p), p);
+             if (!_script_parse_line(line, ++n))
+               return EINA_FALSE;
+          }
+        return EINA_TRUE;
+     }
+
+   f = fopen(path, "r");
+   if (!f)
+     {
+        perror(path);
+        return EINA_FALSE;
+     }
+   while (fgets(line, sizeof(line), f))
+     if (!_script_parse_line(line, ++n))
+       {
+          fclose(f);
+          return EINA_FALSE;
+       }
+   fclose(f);
+   if (!eina_inarray_count(load.script))
+     {
+        fprintf(stderr, "Empty script %s\n", path);
+        return EINA_FALSE;
+     }
+   return EINA_TRUE;
+}
+
+/* Splits the records between the seats */
+static Eina_Bool
+_trace_load(const char *path)
+{
+   const struct Event_Trace_Record *rec;
+   Eina_Inarray *records;
+   unsigned nseats, i, n;
+
+   records = event_trace_load(path, &load.source, &nseats);
+   if (!records)
+     return EINA_FALSE;
+   n = eina_inarray_count(records);
+   if (!n)
+     {
+        fprintf(stderr, "Empty trace %s\n", path);
+        goto err;
+     }
+
+   load.seats = calloc(nseats, sizeof(struct Load_Seat));
+   EINA_SAFETY_ON_NULL_GOTO(load.seats, err);
+   load.nseats = nseats;
+   for (i = 0; i < nseats; i++)
+     {
+        load.seats[i].trace = eina_inarray_new(sizeof(*rec), 0);
+        EINA_SAFETY_ON_NULL_GOTO(load.seats[i].trace, err);
+     }
+
+   rec = eina_inarray_nth(records, 0);
+   load.trace_base = rec->time;
+   for (i = 0; i < n; i++)
+     {
+        rec = eina_inarray_nth(records, i);
+        /* Seats are drained in turns, the earliest is not always first */
+        if ((int32_t)(rec->time - load.trace_base) < 0)
+          load.trace_base = rec->time;
+        EINA_SAFETY_ON_TRUE_GOTO(eina_inarray_push(load.seats[rec->seat].trace,
+                                                   rec) < 0, err);
+     }
+   eina_inarray_free(records);
+   load.replay = EINA_TRUE;
+   return EINA_TRUE;
+
+ err:
+   if (load.seats)
+     {
+        for (i = 0; i < load.nseats; i++)
+          if (load.seats[i].trace)
+            eina_inarray_free(load.seats[i].trace);
+        free(load.seats);
+        load.seats = NULL;
+     }
+   eina_inarray_free(records);
+   return EINA_FALSE;
+}
+
+/* When the next record of the seat has to be sent */
+static double
+_replay_due(const struct Load_Seat *s)
+{
+   const struct Event_Trace_Record *rec;
+
+   if (s->step == eina_inarray_count(s->trace))
+     return INFINITY;
+   if (!load.speed)
+     return s->trace_start;
+   rec = eina_inarray_nth(s->trace, s->step);
+   return s->trace_start +
+      (uint32_t)(rec->time - load.trace_base) / 1000.0 / load.speed;
+}
+
+static void
+_request(struct Load_Seat *s, Eina_Bool incremental)
+{
+   s->request_time = bench_now();
+   rfb_client_update_request(s->client, incremental);
+}
+
+static void
+_ready(void *data, Rfb_Client *c)
+{
+   struct Load_Seat *s = data;
+
+   s->ready = EINA_TRUE;
+   s->next_input = bench_now();
+   if (load.replay)
+     {
+        s->trace_start = s->next_input;
+        s->next_input = _replay_due(s);
+     }
+   _request(s, EINA_FALSE);
+}
+
+static void
+_update(void *data, Rfb_Client *c)
+{
+   struct Load_Seat *s = data;
+   double now = bench_now(), latency;
+
+   if (s->input_time && s->request_time >= s->input_time)
+     {
+        latency = now - s->input_time;
+        eina_inarray_push(s->latency, &latency);
+        eina_inarray_push(load.latency, &latency);
+        s->input_time = 0;
+     }
+   s->frames++;
+   load.frames++;
+   _request(s, EINA_TRUE);
+}
+
+static const Rfb_Client_Cb cb = { _ready, _update };
+
+/* Plays the script steps that got due */
+static void
+_seat_input(struct Load_Seat *s, double now)
+{
+   const struct Step *step;
+   unsigned n = eina_inarray_count(load.script);
+
+   /* Too far behind, catching up would only send a burst */
+   if (now - s->next_input > 1)
+     s->next_input = now;
+   while (s->next_input <= now)
+     {
+        step = eina_inarray_nth(load.script, s->step);
+        s->step = (s->step + 1) % n;
+        switch (step->type)
+          {
+           case STEP_MOVE:
+              s->x = step->a;
+              s->y = step->b;
+              rfb_client_pointer(s->client, s->x, s->y, 0);
+              break;
+           case STEP_BUTTON:
+              rfb_client_pointer(s->client, s->x, s->y, 1 << (step->a - 1));
+              rfb_client_pointer(s->client, s->x, s->y, 0);
+              break;
+           case STEP_KEY:
+              rfb_client_key(s->client, step->a, EINA_TRUE);
+              rfb_client_key(s->client, step->a, EINA_FALSE);
+              break;
+           case STEP_WAIT:
+              s->next_input += step->a / 1000.0;
+              continue;
+          }
+        if (!s->input_time)
+          s->input_time = now;
+        s->next_input += load.interval;
+     }
+}
+
+static void
+_seat_close(struct Load_Seat *s)
+{
+   load.received += rfb_client_received(s->client);
+   rfb_client_free(s->client);
+   s->client = NULL;
+   load.alive--;
+}
+
+/* Sends the trace records that got due, late ones are not skipped so the
+   server gets the whole trace */
+static void
+_seat_replay(struct Load_Seat *s, double now)
+{
+   const struct Event_Trace_Record *rec;
+   unsigned burst = 0;
+   Eina_Bool sent;
+
+   while (s->next_input <= now && burst++ < REPLAY_BURST)
+     {
+        rec = eina_inarray_nth(s->trace, s->step++);
+        sent = EINA_TRUE;
+        switch (rec->type)
+          {
+           case EVENT_POINTER_MOTION:
+              s->x = rec->a;
+              s->y = rec->b;
+              rfb_client_pointer(s->client, s->x, s->y, s->buttons);
+              break;
+           case EVENT_POINTER_BUTTON:
+              /* Both servers trace left, middle and right as 1 to 3, RFB
+                 has no others past 8 */
+              if (rec->a < 1 || rec->a > 8)
+                {
+                   sent = EINA_FALSE;
+                   break;
+                }
+              if (rec->b)
+                s->buttons |= 1 << (rec->a - 1);
+              else
+                s->buttons &= ~(1 << (rec->a - 1));
+              rfb_client_pointer(s->client, s->x, s->y, s->buttons);
+              break;
+           case EVENT_KEY:
+              /* Linux key codes have no keysym without a keymap */
+              sent = load.source == EVENT_TRACE_VNC;
+              if (sent)
+                rfb_client_key(s->client, rec->a, rec->b);
+              break;
+           case EVENT_TRACE_SEAT_GONE:
+              s->step = eina_inarray_count(s->trace);
+              _seat_close(s);
+              return;
+           case EVENT_TRACE_DROPPED:
+              load.dropped += rec->a;
+              /* fall through */
+           default:
+              sent = EINA_FALSE;
+              break;
+          }
+        if (sent && !s->input_time)
+          s->input_time = now;
+        s->next_input = _replay_due(s);
+     }
+}
+
+/* Seats still connected with records left */
+static unsigned
+_replaying(void)
+{
+   const struct Load_Seat *s;
+   unsigned i, n = 0;
+
+   for (i = 0; i < load.nseats; i++)
+     {
+        s = &load.seats[i];
+        if (s->client && s->step < eina_inarray_count(s->trace))
+          n++;
+     }
+   return n;
+}
+
+static Eina_Bool
+_seat_open(struct Load_Seat *s, int epoll_fd, const char *host, int port)
+{
+   struct epoll_event ev;
+
+   s->latency = eina_inarray_new(sizeof(double), 0);
+   EINA_SAFETY_ON_NULL_RETURN_VAL(s->latency, EINA_FALSE);
+   if (load.local)
+     s->client = rfb_client_connect_local(load.local, &cb, s);
+   else
+     s->client = rfb_client_connect(host, port, &cb, s);
+   if (!s->client)
+     return EINA_FALSE;
+
+   ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+   ev.data.ptr = s;
+   if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, rfb_client_fd(s->client), &ev))
+     {
+        rfb_client_free(s->client);
+        s->client = NULL;
+        return EINA_FALSE;
+     }
+   load.alive++;
+   return EINA_TRUE;
+}
+
+static unsigned long long
+_received(void)
+{
+   unsigned long long total = load.received;
+   unsigned i;
+
+   for (i = 0; i < load.nseats; i++)
+     if (load.seats[i].client)
+       total += rfb_client_received(load.seats[i].client);
+   return total;
+}
+
+static void
+_report(double elapsed, double cpu, unsigned long long received)
+{
+   printf("%6u %8.1f %9.2f %8.2f %8.2f", load.alive,
+          load.frames / elapsed, received / elapsed / (1024 * 1024),
+          bench_percentile(load.latency, 50),
+          bench_percentile(load.latency, 99));
+   if (cpu >= 0)
+     printf(" %6.1f", cpu * 100 / elapsed);
+   printf("\n");
+   fflush(stdout);
+
+   eina_inarray_flush(load.latency);
+   load.frames = 0;
+}
+
+static void
+_seats_report(double elapsed)
+{
+   struct Load_Seat *s;
+   unsigned i;
+
+   printf("\n%6s %8s %9s %8s %8s %6s\n", "seat", "fps", "KiB/s", "input50",
+          "input99", "state");
+   for (i = 0; i < load.nseats; i++)
+     {
+        s = &load.seats[i];
+        printf("%6u %8.1f %9.1f %8.2f %8.2f %6s\n", i, s->frames / elapsed,
+               s->client ? rfb_client_received(s->client) / elapsed / 1024 : 0,
+               bench_percentile(s->latency, 50),
+               bench_percentile(s->latency, 99),
+               s->client ? "up" : "down");
+     }
+}
+
+static void
+_sig_action(int sig)
+{
+   stop = 1;
+}
+
+static void
+_usage(const char *name)
+{
+   fprintf(stderr, "Usage: %s [-n seats] [-r steps/s] [-d seconds] "
+           "[-f script] [-t trace [-x speed]] [-p pid] "
+           "[-l path | host [port]]\n",
+           name);
+}
+
+int
+main(int argc, char **argv)
+{
+   struct epoll_event ev[EVENTS];
+   struct Load_Seat *s;
+   struct rlimit rl;
+   struct sigaction sa;
+   const char *host = "localhost", *script = NULL, *trace = NULL;
+   double rate = 100, duration = 0, start, now, last, cpu, prev_cpu = -1;
+   double cur_cpu;
+   unsigned long long received, prev_received = 0;
+   unsigned i;
+   int epoll_fd, port = 5900, opt, n, r = 1;
+   pid_t pid = 0;
+
+   load.nseats = 100;
+   load.speed = 1;
+   while ((opt = getopt(argc, argv, "n:r:d:f:t:x:p:l:")) != -1)
+     {
+        switch (opt)
+          {
+           case 'n': load.nseats = atoi(optarg); break;
+           case 'r': rate = atof(optarg); break;
+           case 'd': duration = atof(optarg); break;
+           case 'f': script = optarg; break;
+           case 't': trace = optarg; break;
+           case 'x': load.speed = atof(optarg); break;
+           case 'p': pid = atoi(optarg); break;
+           case 'l': load.local = optarg; break;
+           default:
+              _usage(argv[0]);
+              return 1;
+          }
+     }
+   if (optind < argc)
+     host = argv[optind++];
+   if (optind < argc)
+     port = atoi(argv[optind++]);
+   if (!load.nseats || rate <= 0 || duration < 0 || load.speed < 0)
+     {
+        _usage(argv[0]);
+        return 1;
+     }
+   load.interval = 1 / rate;
+   /* A trace runs until it is all sent */
+   if (!duration)
+     duration = trace ? INFINITY : 10;
+
+   eina_init();
+
+   load.script = eina_inarray_new(sizeof(struct Step), 0);
+   EINA_SAFETY_ON_NULL_GOTO(load.script, err_script);
+   if (trace ? !_trace_load(trace) : !_script_load(script))
+     goto err_load;
+   load.latency = eina_inarray_new(sizeof(double), 0);
+   EINA_SAFETY_ON_NULL_GOTO(load.latency, err_load);
+   if (!load.seats)
+     load.seats = calloc(load.nseats, sizeof(struct Load_Seat));
+   EINA_SAFETY_ON_NULL_GOTO(load.seats, err_seats);
+
+   /* One socket per seat */
+   if (!getrlimit(RLIMIT_NOFILE, &rl) && rl.rlim_cur < load.nseats + 64)
+     {
+        rl.rlim_cur = rl.rlim_max < load.nseats + 64 ?
+           rl.rlim_max : load.nseats + 64;
+        setrlimit(RLIMIT_NOFILE, &rl);
+     }
+
+   sa.sa_handler = _sig_action;
+   sa.sa_flags = 0;
+   sigemptyset(&sa.sa_mask);
+   sigaction(SIGINT, &sa, NULL);
+   sigaction(SIGTERM, &sa, NULL);
+
+   epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+   EINA_SAFETY_ON_TRUE_GOTO(epoll_fd == -1, err_epoll);
+
+   for (i = 0; i < load.nseats; i++)
+     if (!_seat_open(&load.seats[i], epoll_fd, host, port))
+       fprintf(stderr, "Seat %u could not connect\n", i);
+
+   printf("%6s %8s %9s %8s %8s%s\n", "seats", "fps", "MiB/s", "input50",
+          "input99", pid ? "   cpu%" : "");
+   if (pid)
+     prev_cpu = bench_cpu_time(pid);
+   start = last = bench_now();
+   while (!stop && (now = bench_now()) < start + duration &&
+          (!load.replay || _replaying()))
+     {
+        n = epoll_wait(epoll_fd, ev, EVENTS, TICK_MS);
+        for (i = 0; i < (unsigned)(n > 0 ? n : 0); i++)
+          {
+             s = ev[i].data.ptr;
+             if (s->client && rfb_client_read(s->client) < 0)
+               _seat_close(s);
+          }
+
+        now = bench_now();
+        for (i = 0; i < load.nseats; i++)
+          {
+             s = &load.seats[i];
+             if (!s->client || !s->ready || s->next_input > now)
+               continue;
+             if (load.replay)
+               _seat_replay(s, now);
+             else
+               _seat_input(s, now);
+             if (s->client && rfb_client_flush(s->client) < 0)
+               _seat_close(s);
+          }
+
+        if (now - last < 1)
+          continue;
+        cpu = -1;
+        if (pid)
+          {
+             cur_cpu = bench_cpu_time(pid);
+             cpu = cur_cpu >= 0 && prev_cpu >= 0 ? cur_cpu - prev_cpu : -1;
+             prev_cpu = cur_cpu;
+          }
+        received = _received();
+        _report(now - last, cpu, received - prev_received);
+        prev_received = received;
+        last = now;
+     }
+   _seats_report(bench_now() - start);
+   if (load.dropped)
+     printf("The trace misses %lu input events the server dropped\n",
+            load.dropped);
+   r = 0;
+
+   close(epoll_fd);
+ err_epoll:
+   for (i = 0; i < load.nseats; i++)
+     {
+        if (load.seats[i].client)
+          rfb_client_free(load.seats[i].client);
+        if (load.seats[i].latency)
+          eina_inarray_free(load.seats[i].latency);
+        if (load.seats[i].trace)
+          eina_inarray_free(load.seats[i].trace);
+     }
+   free(load.seats);
+ err_seats:
+   eina_inarray_free(load.latency);
+ err_load:
+   eina_inarray_free(load.script);
+ err_script:
+   eina_shutdown();
+   return r;
+}
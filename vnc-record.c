@@ -0,0 +1,559 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <zlib.h>
+#include "vnc-record.h"
+
+/* How long the writer sleeps when nothing was queued */
+#define IDLE_NSEC (5 * 1000 * 1000)
+/* A seat gets a keyframe at least this often, in seconds */
+#define KEYFRAME_INTERVAL (10.0)
+/* Recordings are written while seats are connected, speed first */
+#define DEFLATE_LEVEL (Z_BEST_SPEED)
+
+struct _Record {
+   /* Main loop side */
+   unsigned seat;
+   double start;
+   double keyframe_time;
+   /* Whether what follows the last keyframe queued is whole */
+   Eina_Bool keyed;
+   rfbPixelFormat format;
+   unsigned dropped;
+   /* Writer side */
+   FILE *file, *index;
+   z_stream z;
+   uint64_t offset;
+   Eina_Bool failed;
+   Eina_Bool dirty;
+};
+
+/* A NULL data closes the record */
+struct Record_Item {
+   Record *record;
+   unsigned char *data;
+   size_t length;
+   uint32_t time;
+   enum Record_Type type;
+   rfbPixelFormat format;
+};
+
+static struct {
+   char *dir;
+   size_t max_queued;
+   /* Names the recordings of this run */
+   long epoch;
+   unsigned serial;
+   /* Open records, main loop only */
+   Eina_List *records;
+   Eina_Thread thread;
+   atomic_bool stop;
+   /* Under the lock */
+   Eina_Lock lock;
+   Eina_List *items;
+   size_t queued;
+   /* Writer only */
+   unsigned char out[64 * 1024];
+} record;
+
+static double
+_now(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static Eina_Bool
+_record_deflate(Record *r, const void *data, size_t length, int flush)
+{
+   size_t n;
+
+   r->z.next_in = (unsigned char *)data;
+   r->z.avail_in = length;
+   do
+     {
+        r->z.next_out = record.out;
+        r->z.avail_out = sizeof(record.out);
+        if (deflate(&r->z, flush) == Z_STREAM_ERROR)
+          return EINA_FALSE;
+        n = sizeof(record.out) - r->z.avail_out;
+        if (n && fwrite(record.out, 1, n, r->file) != n)
+          return EINA_FALSE;
+        r->offset += n;
+     }
+   while (!r->z.avail_out);
+   return EINA_TRUE;
+}
+
+static Eina_Bool
+_record_entry(Record *r, enum Record_Type type, uint32_t time,
+              const void *data, size_t length)
+{
+   struct Record_Entry entry = { type, time, length };
+
+   return _record_deflate(r, &entry, sizeof(entry), Z_NO_FLUSH) &&
+      _record_deflate(r, data, length, Z_NO_FLUSH);
+}
+
+/* Nothing before a keyframe is needed to inflate it */
+static Eina_Bool
+_record_keyframe(Record *r, const struct Record_Item *item)
+{
+   struct Record_Index index = { 0 };
+
+   if (!_record_deflate(r, NULL, 0, Z_FULL_FLUSH))
+     return EINA_FALSE;
+   index.offset = r->offset;
+   index.time = item->time;
+   return fwrite(&index, sizeof(index), 1, r->index) == 1 &&
+      _record_entry(r, RECORD_FORMAT, item->time, &item->format,
+                    sizeof(item->format)) &&
+      _record_entry(r, RECORD_KEYFRAME, item->time, item->data,
+                    item->length);
+}
+
+static void
+_record_free(Record *r)
+{
+   if (!r->failed && !_record_deflate(r, NULL, 0, Z_FINISH))
+     perror("Recording");
+   deflateEnd(&r->z);
+   if (fclose(r->file))
+     perror("Recording");
+   if (fclose(r->index))
+     perror("Recording");
+   if (r->dropped)
+     printf("Seat '%u' recording misses %u updates\n", r->seat, r->dropped);
+   free(r);
+}
+
+static void
+_item_write(struct Record_Item *item)
+{
+   Record *r = item->record;
+   Eina_Bool ok;
+
+   if (!item->data)
+     {
+        _record_free(r);
+        return;
+     }
+   if (r->failed)
+     return;
+   if (item->type == RECORD_KEYFRAME)
+     ok = _record_keyframe(r, item);
+   else
+     ok = _record_entry(r, item->type, item->time, item->data,
+                        item->length);
+   r->dirty = EINA_TRUE;
+   if (!ok)
+     {
+        perror("Recording");
+        r->failed = EINA_TRUE;
+     }
+}
+
+/* Leaves every record readable up to its last update */
+static void
+_record_flush(Record *r)
+{
+   r->dirty = EINA_FALSE;
+   if (r->failed)
+     return;
+   if (!_record_deflate(r, NULL, 0, Z_SYNC_FLUSH) ||
+       fflush(r->file) || fflush(r->index))
+     {
+        perror("Recording");
+        r->failed = EINA_TRUE;
+     }
+}
+
+static void *
+_record_thread(void *data, Eina_Thread t)
+{
+   struct timespec idle = { 0, IDLE_NSEC };
+   struct Record_Item *item;
+   Eina_List *items, *written = NULL;
+   Record *r;
+   Eina_Bool stop;
+
+   for (;;)
+     {
+        stop = atomic_load_explicit(&record.stop, memory_order_acquire);
+        eina_lock_take(&record.lock);
+        items = record.items;
+        record.items = NULL;
+        eina_lock_release(&record.lock);
+        if (!items)
+          {
+             if (stop)
+               break;
+             nanosleep(&idle, NULL);
+             continue;
+          }
+
+        EINA_LIST_FREE(items, item)
+          {
+             r = item->record;
+             /* Closing is the last item of its record */
+             if (!item->data)
+               written = eina_list_remove(written, r);
+             else if (!r->dirty)
+               written = eina_list_append(written, r);
+             _item_write(item);
+             eina_lock_take(&record.lock);
+             record.queued -= item->length;
+             eina_lock_release(&record.lock);
+             free(item->data);
+             free(item);
+          }
+        EINA_LIST_FREE(written, r)
+          _record_flush(r);
+     }
+   return NULL;
+}
+
+static void
+_item_queue(struct Record_Item *item)
+{
+   eina_lock_take(&record.lock);
+   record.items = eina_list_append(record.items, item);
+   record.queued += item->length;
+   eina_lock_release(&record.lock);
+}
+
+Eina_Bool
+record_init(const char *dir, size_t max_queued)
+{
+   record.dir = strdup(dir);
+   EINA_SAFETY_ON_NULL_RETURN_VAL(record.dir, EINA_FALSE);
+   record.max_queued = max_queued;
+   record.epoch = time(NULL);
+   atomic_init(&record.stop, EINA_FALSE);
+   EINA_SAFETY_ON_FALSE_GOTO(eina_lock_new(&record.lock), err_lock);
+   if (!eina_thread_create(&record.thread, EINA_THREAD_BACKGROUND, -1,
+                           _record_thread, NULL))
+     goto err_thread;
+   return EINA_TRUE;
+
+ err_thread:
+   eina_lock_free(&record.lock);
+ err_lock:
+   free(record.dir);
+   record.dir = NULL;
+   return EINA_FALSE;
+}
+
+void
+record_shutdown(void)
+{
+   if (!record.dir)
+     return;
+   while (record.records)
+     record_close(eina_list_data_get(record.records));
+   atomic_store_explicit(&record.stop, EINA_TRUE, memory_order_release);
+   eina_thread_join(record.thread);
+   eina_lock_free(&record.lock);
+   free(record.dir);
+   record.dir = NULL;
+}
+
+Record *
+record_open(unsigned seat, int width, int height)
+{
+   struct Record_Header header = { .width = width, .height = height };
+   char path[PATH_MAX];
+   Record *r;
+
+   if (!record.dir)
+     return NULL;
+   r = calloc(1, sizeof(Record));
+   EINA_SAFETY_ON_NULL_RETURN_VAL(r, NULL);
+   r->seat = seat;
+   /* Seat ids are reused, the serial keeps every session apart */
+   snprintf(path, sizeof(path), "%s/%ld-%u-seat%u.rec", record.dir,
+            record.epoch, record.serial, seat);
+   r->file = fopen(path, "wbe");
+   if (!r->file)
+     goto err_file;
+   snprintf(path, sizeof(path), "%s/%ld-%u-seat%u.idx", record.dir,
+            record.epoch, record.serial, seat);
+   r->index = fopen(path, "wbe");
+   if (!r->index)
+     goto err_index;
+   record.serial++;
+
+   memcpy(header.magic, RECORD_MAGIC, RECORD_MAGIC_LEN);
+   if (fwrite(&header, sizeof(header), 1, r->file) != 1 ||
+       fwrite(RECORD_INDEX_MAGIC, RECORD_MAGIC_LEN, 1, r->index) != 1)
+     goto err_header;
+   r->offset = sizeof(header);
+   /* Raw deflate, inflating can start at any keyframe */
+   if (deflateInit2(&r->z, DEFLATE_LEVEL, Z_DEFLATED, -15, 8,
+                    Z_DEFAULT_STRATEGY) != Z_OK)
+     goto err_header;
+
+   r->start = _now();
+   record.records = eina_list_append(record.records, r);
+   return r;
+
+ err_header:
+   fclose(r->index);
+ err_index:
+   fclose(r->file);
+ err_file:
+   perror(path);
+   free(r);
+   return NULL;
+}
+
+void
+record_close(Record *r)
+{
+   struct Record_Item *item;
+
+   record.records = eina_list_remove(record.records, r);
+   item = calloc(1, sizeof(struct Record_Item));
+   /* Never finished, it is readable up to its last flush */
+   EINA_SAFETY_ON_NULL_RETURN(item);
+   item->record = r;
+   _item_queue(item);
+}
+
+Eina_Bool
+record_keyframe_due(const Record *r, const rfbPixelFormat *format)
+{
+   return !r->keyed || memcmp(format, &r->format, sizeof(*format)) ||
+      _now() - r->keyframe_time >= KEYFRAME_INTERVAL;
+}
+
+void
+record_update(Record *r, const rfbPixelFormat *format, Eina_Bool keyframe,
+              const Eina_Binbuf *msg)
+{
+   struct Record_Item *item;
+   size_t length = eina_binbuf_length_get(msg);
+   double now = _now();
+   Eina_Bool full;
+
+   /* Meaningless without the keyframe before */
+   if (!keyframe && (!r->keyed || memcmp(format, &r->format,
+                                         sizeof(*format))))
+     return;
+
+   eina_lock_take(&record.lock);
+   full = record.queued + length > record.max_queued;
+   eina_lock_release(&record.lock);
+   if (full)
+     goto drop;
+
+   item = calloc(1, sizeof(struct Record_Item));
+   EINA_SAFETY_ON_NULL_GOTO(item, drop);
+   item->data = malloc(length);
+   EINA_SAFETY_ON_NULL_GOTO(item->data, err_data);
+   memcpy(item->data, eina_binbuf_string_get(msg), length);
+   item->record = r;
+   item->length = length;
+   item->time = (now - r->start) * 1000;
+   item->type = keyframe ? RECORD_KEYFRAME : RECORD_UPDATE;
+   item->format = *format;
+   _item_queue(item);
+
+   if (keyframe)
+     {
+        r->keyed = EINA_TRUE;
+        r->keyframe_time = now;
+        r->format = *format;
+     }
+   return;
+
+ err_data:
+   free(item);
+ drop:
+   r->dropped++;
+   record_gap(r, RECORD_GAP_DROPPED, length);
+}
+
+void
+record_gap(Record *r, enum Record_Gap_Reason reason, size_t length)
+{
+   struct Record_Item *item;
+   struct Record_Gap *gap;
+
+   /* Playback starts over at the next keyframe */
+   r->keyed = EINA_FALSE;
+   /* Past the queue limit too, it is small and says what is missing */
+   item = calloc(1, sizeof(struct Record_Item));
+   EINA_SAFETY_ON_NULL_RETURN(item);
+   gap = malloc(sizeof(struct Record_Gap));
+   EINA_SAFETY_ON_NULL_GOTO(gap, err_gap);
+   gap->reason = reason;
+   gap->length = length > UINT32_MAX ? UINT32_MAX : length;
+   item->record = r;
+   item->data = (unsigned char *)gap;
+   item->length = sizeof(struct Record_Gap);
+   item->time = (_now() - r->start) * 1000;
+   item->type = RECORD_GAP;
+   _item_queue(item);
+   return;
+
+ err_gap:
+   free(item);
+}
+
+struct _Record_Reader {
+   FILE *file;
+   /* Of struct Record_Index */
+   Eina_Inarray *index;
+   z_stream z;
+   unsigned char in[64 * 1024];
+};
+
+static Eina_Inarray *
+_reader_index_load(const char *path)
+{
+   struct Record_Index index;
+   char idx[PATH_MAX], magic[RECORD_MAGIC_LEN];
+   Eina_Inarray *a;
+   size_t len = strlen(path);
+   FILE *f;
+
+   /* foo.rec goes with foo.idx */
+   if (len < 4 || strcmp(path + len - 4, ".rec") ||
+       (size_t)snprintf(idx, sizeof(idx), "%.*s.idx", (int)len - 4, path) >=
+       sizeof(idx))
+     return NULL;
+   f = fopen(idx, "rbe");
+   if (!f)
+     return NULL;
+   if (fread(magic, sizeof(magic), 1, f) != 1 ||
+       memcmp(magic, RECORD_INDEX_MAGIC, RECORD_MAGIC_LEN))
+     goto err;
+   a = eina_inarray_new(sizeof(index), 64);
+   EINA_SAFETY_ON_NULL_GOTO(a, err);
+   while (fread(&index, sizeof(index), 1, f) == 1)
+     if (eina_inarray_push(a, &index) < 0)
+       break;
+   fclose(f);
+   return a;
+
+ err:
+   fclose(f);
+   return NULL;
+}
+
+Record_Reader *
+record_reader_open(const char *path, struct Record_Header *header)
+{
+   Record_Reader *rd;
+
+   rd = calloc(1, sizeof(Record_Reader));
+   EINA_SAFETY_ON_NULL_RETURN_VAL(rd, NULL);
+   rd->file = fopen(path, "rbe");
+   if (!rd->file)
+     {
+        perror(path);
+        goto err_file;
+     }
+   if (fread(header, sizeof(*header), 1, rd->file) != 1 ||
+       memcmp(header->magic, RECORD_MAGIC, RECORD_MAGIC_LEN))
+     {
+        fprintf(stderr, "%s is not a recording\n", path);
+        goto err_header;
+     }
+   if (inflateInit2(&rd->z, -15) != Z_OK)
+     goto err_header;
+   /* Without it, only reading from the start works */
+   rd->index = _reader_index_load(path);
+   return rd;
+
+ err_header:
+   fclose(rd->file);
+ err_file:
+   free(rd);
+   return NULL;
+}
+
+void
+record_reader_close(Record_Reader *rd)
+{
+   inflateEnd(&rd->z);
+   if (rd->index)
+     eina_inarray_free(rd->index);
+   fclose(rd->file);
+   free(rd);
+}
+
+Eina_Bool
+record_reader_seek(Record_Reader *rd, uint32_t time)
+{
+   const struct Record_Index *index, *found = NULL;
+   unsigned i, n;
+
+   if (!rd->index)
+     return EINA_FALSE;
+   n = eina_inarray_count(rd->index);
+   for (i = 0; i < n; i++)
+     {
+        index = eina_inarray_nth(rd->index, i);
+        if (index->time > time)
+          break;
+        found = index;
+     }
+   if (!found || fseeko(rd->file, found->offset, SEEK_SET))
+     return EINA_FALSE;
+   inflateReset(&rd->z);
+   rd->z.avail_in = 0;
+   return EINA_TRUE;
+}
+
+static Eina_Bool
+_reader_read(Record_Reader *rd, void *buf, size_t length)
+{
+   int r;
+
+   rd->z.next_out = buf;
+   rd->z.avail_out = length;
+   while (rd->z.avail_out)
+     {
+        if (!rd->z.avail_in)
+          {
+             rd->z.next_in = rd->in;
+             rd->z.avail_in = fread(rd->in, 1, sizeof(rd->in), rd->file);
+             /* A recording still written or cut short ends here */
+             if (!rd->z.avail_in)
+               return EINA_FALSE;
+          }
+        r = inflate(&rd->z, Z_NO_FLUSH);
+        if (r == Z_STREAM_END && rd->z.avail_out)
+          return EINA_FALSE;
+        if (r != Z_OK && r != Z_STREAM_END && r != Z_BUF_ERROR)
+          return EINA_FALSE;
+     }
+   return EINA_TRUE;
+}
+
+Eina_Bool
+record_reader_next(Record_Reader *rd, struct Record_Entry *entry,
+                   Eina_Binbuf *data)
+{
+   unsigned char buf[4096];
+   size_t left, n;
+
+   eina_binbuf_reset(data);
+   if (!_reader_read(rd, entry, sizeof(*entry)))
+     return EINA_FALSE;
+   for (left = entry->length; left; left -= n)
+     {
+        n = left < sizeof(buf) ? left : sizeof(buf);
+        if (!_reader_read(rd, buf, n) ||
+            !eina_binbuf_append_length(data, buf, n))
+          return EINA_FALSE;
+     }
+   return EINA_TRUE;
+}
@@ -0,0 +1,102 @@
+#ifndef VNC_RECORD_H
+#define VNC_RECORD_H
+
+#include <stdint.h>
+#include <Eina.h>
+#include <rfb/rfbproto.h>
+
+/* Session recordings: every framebuffer update message sent to a seat, as
+   encoded for it, deflated by a writer thread into one file per seat
+   session. The seat never waits for the disk, updates are dropped while
+   more than the queue limit waits for the writer.
+
+   A recording is a header, then a raw deflate stream of records. Keyframe
+   records carry an update covering the whole screen and are preceded by a
+   full flush, so inflating can start there; their offsets are appended to
+   an index file next to the recording to seek without inflating what is
+   before. Everything after a keyframe only depends on it. Updates the
+   seat was sent but the recording misses leave a gap record, and the
+   next update recorded is a keyframe. */
+
+#define RECORD_MAGIC "MSREC001"
+#define RECORD_INDEX_MAGIC "MSIDX001"
+#define RECORD_MAGIC_LEN (8)
+
+enum Record_Type {
+   /* An rfbPixelFormat, opens every keyframe */
+   RECORD_FORMAT,
+   /* A FramebufferUpdate message */
+   RECORD_UPDATE,
+   /* An update covering the whole screen without copies */
+   RECORD_KEYFRAME,
+   /* A struct Record_Gap, playback resumes at the next keyframe */
+   RECORD_GAP
+};
+
+enum Record_Gap_Reason {
+   /* Encoded by libvncserver, in an encoding the recording cannot take */
+   RECORD_GAP_LIBVNCSERVER,
+   /* Dropped while the writer was behind */
+   RECORD_GAP_DROPPED
+};
+
+struct Record_Gap {
+   uint32_t reason;
+   /* Bytes of the update missed */
+   uint32_t length;
+};
+
+struct Record_Header {
+   char magic[RECORD_MAGIC_LEN];
+   uint32_t width, height;
+};
+
+struct Record_Entry {
+   uint32_t type;
+   /* Milliseconds since the recording started */
+   uint32_t time;
+   uint32_t length;
+};
+
+struct Record_Index {
+   /* Of the keyframe format record in the recording */
+   uint64_t offset;
+   uint32_t time;
+   uint32_t reserved;
+};
+
+typedef struct _Record Record;
+
+/* Recordings go to dir, the writer keeps at most max_queued bytes */
+Eina_Bool record_init(const char *dir, size_t max_queued);
+/* Writes what is queued and joins the writer */
+void record_shutdown(void);
+
+/* Called from the main loop only */
+Record *record_open(unsigned seat, int width, int height);
+/* The writer frees it once everything queued is written */
+void record_close(Record *r);
+/* The next update should cover the whole screen: none was recorded yet,
+   one was dropped, the format changed or the last keyframe is old */
+Eina_Bool record_keyframe_due(const Record *r, const rfbPixelFormat *format);
+/* Copies msg, keyframe when it covers the whole screen */
+void record_update(Record *r, const rfbPixelFormat *format,
+                   Eina_Bool keyframe, const Eina_Binbuf *msg);
+/* An update of length bytes was sent without being recorded */
+void record_gap(Record *r, enum Record_Gap_Reason reason, size_t length);
+
+/* Reading, from the first keyframe or the one seeked to */
+typedef struct _Record_Reader Record_Reader;
+
+Record_Reader *record_reader_open(const char *path,
+                                  struct Record_Header *header);
+void record_reader_close(Record_Reader *rd);
+/* Goes to the last keyframe at or before time, in milliseconds, through
+   the index next to the recording */
+Eina_Bool record_reader_seek(Record_Reader *rd, uint32_t time);
+/* Fills entry and replaces data with its bytes, EINA_FALSE past the last
+   whole one */
+Eina_Bool record_reader_next(Record_Reader *rd, struct Record_Entry *entry,
+                             Eina_Binbuf *data);
+
+#endif
@@ -0,0 +1,18 @@
+#ifndef VNC_SHM_H
+#define VNC_SHM_H
+
+/* Viewers on the same host, connected to the Unix socket multi-seat-vnc
+   listens on with -L, can read their seat pixels straight from its frame
+   buffer instead of getting them through the socket. The protocol is RFB
+   with two private encodings; the viewer has to keep the server pixel
+   format and read the pixels of an update before asking for the next one,
+   which is when the server may render over them. */
+
+/* Asked for in SetEncodings, then used for rectangles without payload:
+   their pixels changed in the shared frame buffer */
+#define SHM_ENCODING (0x4d534801)
+/* A pseudo rectangle sent once before any other, its memfd passed along
+   the first byte of its update: w * h pixels, rows w * 4 bytes apart */
+#define SHM_ENCODING_FD (0x4d534802)
+
+#endif